@@ -0,0 +1,122 @@
+#include "ApiRateLimiter.h"
+#include "Settings.h"
+#include <QUrl>
+#include <QDebug>
+#include <cmath>
+
+static constexpr double DefaultRate = 10.0; // requests/s
+static constexpr double MinRate = 0.25; // requests/s
+static constexpr double BurstSeconds = 2.0; // bucket size: rate * BurstSeconds
+static constexpr double RecoveryStep = 0.05; // of max rate, on each success
+
+static const std::pair<const char*, double> DefaultRates[] = {
+    { "playurl", 4.0 },
+    { "manga", 8.0 },
+    { "live", 2.0 },
+};
+
+Q_GLOBAL_STATIC(ApiRateLimiter, apiRateLimiter)
+
+ApiRateLimiter *ApiRateLimiter::inst()
+{
+    return apiRateLimiter;
+}
+
+bool ApiRateLimiter::isThrottleCode(int code)
+{
+    return code == -412 || code == -509 || code == -799;
+}
+
+QString ApiRateLimiter::familyOf(const QUrl &url)
+{
+    auto host = url.host();
+    if (url.path().contains("/playurl")) {
+        return "playurl";
+    }
+    if (host.startsWith("manga.")) {
+        return "manga";
+    }
+    if (host.startsWith("api.live.")) {
+        return "live";
+    }
+    return host;
+}
+
+ApiRateLimiter::ApiRateLimiter()
+{
+    elapsedTimer.start();
+    for (auto &[family, rate] : DefaultRates) {
+        configuredRates.insert(family, rate);
+    }
+    for (auto &item : Settings::inst()->value("network/rateLimits").toStringList()) {
+        auto familyAndRate = item.split('=');
+        bool ok;
+        auto rate = familyAndRate.value(1).trimmed().toDouble(&ok);
+        if (familyAndRate.size() == 2 && ok && rate > 0) {
+            configuredRates.insert(familyAndRate[0].trimmed(), std::max(rate, MinRate));
+        }
+    }
+}
+
+ApiRateLimiter::Bucket &ApiRateLimiter::bucketOf(const QString &family)
+{
+    auto it = buckets.find(family);
+    if (it == buckets.end()) {
+        auto rate = configuredRates.value(family, DefaultRate);
+        it = buckets.insert(family, { rate, rate, rate * BurstSeconds, elapsedTimer.elapsed() });
+    }
+
+    auto &bucket = it.value();
+    auto now = elapsedTimer.elapsed();
+    auto burst = bucket.rate * BurstSeconds;
+    bucket.tokens = std::min(burst, bucket.tokens + (now - bucket.lastRefillTime) * bucket.rate / 1000);
+    bucket.lastRefillTime = now;
+    return bucket;
+}
+
+qint64 ApiRateLimiter::reserve(const QUrl &url, bool *isReserved)
+{
+    QMutexLocker locker(&mutex);
+    auto &bucket = bucketOf(familyOf(url));
+    // negative tokens are reserved by queued requests. a large batch must not stall the family
+    // (including interactive requests) for long, so tokens are not reserved beyond MaxWait
+    if (bucket.tokens - 1 < -bucket.rate * MaxWait / 1000) {
+        *isReserved = false;
+        return MaxWait / 2;
+    }
+    *isReserved = true;
+    bucket.tokens -= 1;
+    if (bucket.tokens >= 0) {
+        return 0;
+    }
+    return qint64(std::ceil(-bucket.tokens * 1000 / bucket.rate));
+}
+
+void ApiRateLimiter::unreserve(const QUrl &url)
+{
+    QMutexLocker locker(&mutex);
+    auto &bucket = bucketOf(familyOf(url));
+    bucket.tokens = std::min(bucket.rate * BurstSeconds, bucket.tokens + 1);
+}
+
+void ApiRateLimiter::onThrottled(const QUrl &url)
+{
+    QMutexLocker locker(&mutex);
+    auto family = familyOf(url);
+    auto &bucket = bucketOf(family);
+    auto now = elapsedTimer.elapsed();
+    if (now - bucket.lastThrottleTime < ThrottleWindow) {
+        return; // the same throttling, reported by RetryPolicy and parseReply
+    }
+    bucket.lastThrottleTime = now;
+    bucket.rate = std::max(MinRate, bucket.rate / 2);
+    bucket.tokens = std::min(bucket.tokens, 0.0); // no burst
+    qDebug() << "throttled:" << family << ", rate limited to" << bucket.rate << "/s";
+}
+
+void ApiRateLimiter::onSucceeded(const QUrl &url)
+{
+    QMutexLocker locker(&mutex);
+    auto &bucket = bucketOf(familyOf(url));
+    bucket.rate = std::min(bucket.maxRate, bucket.rate + bucket.maxRate * RecoveryStep);
+}
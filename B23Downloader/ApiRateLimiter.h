@@ -0,0 +1,65 @@
+#ifndef APIRATELIMITER_H
+#define APIRATELIMITER_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QHash>
+
+class QUrl;
+
+/**
+ * @brief ApiRateLimiter paces API requests (sent through RetryPolicy) with a token bucket per endpoint family:
+ * "playurl" (play url APIs), "manga" (manga.bilibili.com), "live" (api.live.bilibili.com) and one per other host.
+ * Requests over the rate are queued (see reserve()), not failed.
+ * The rate adapts: it's halved when throttled (code -412/-509/-799 or HTTP 412/429), at most once per
+ * ThrottleWindow, and recovers a little on each success, up to the configured rate.
+ * Requests already queued keep their schedule when the rate is halved. those throttled again are queued
+ * again (see RetryPolicy), behind the slowed limiter.
+ * Rates (requests/s) can be overridden with Settings "network/rateLimits": list of "family=rate".
+ */
+class ApiRateLimiter
+{
+public:
+    static constexpr int ThrottleWindow = 2000; // ms
+    static constexpr int MaxWait = 60000; // ms. tokens are reserved at most this time ahead (at current rate)
+
+    static ApiRateLimiter *inst();
+    static bool isThrottleCode(int code);
+    static QString familyOf(const QUrl &url);
+
+    ApiRateLimiter();
+
+    /**
+     * @brief takes a token of the family of url, unless tokens are reserved MaxWait ahead already
+     * @param isReserved set to whether the token is taken
+     * @return time (ms) to wait before sending the request if reserved, otherwise before trying again
+     */
+    qint64 reserve(const QUrl &url, bool *isReserved);
+
+    /**
+     * @brief returns a token taken by reserve() but not used (the request is cancelled or has to wait for something else)
+     */
+    void unreserve(const QUrl &url);
+
+    void onThrottled(const QUrl &url);
+    void onSucceeded(const QUrl &url);
+
+private:
+    struct Bucket
+    {
+        double maxRate; // tokens/s
+        double rate;
+        double tokens;
+        qint64 lastRefillTime;
+        qint64 lastThrottleTime = -ThrottleWindow;
+    };
+
+    QMutex mutex;
+    QHash<QString, double> configuredRates;
+    QHash<QString, Bucket> buckets;
+    QElapsedTimer elapsedTimer;
+
+    Bucket &bucketOf(const QString &family);
+};
+
+#endif // APIRATELIMITER_H
@@ -22,33 +22,69 @@ DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs depr
 
 SOURCES += \
     AboutWidget.cpp \
+    ApiRateLimiter.cpp \
+    BandwidthShaper.cpp \
+    BufferedWriter.cpp \
+    CbzWriter.cpp \
+    ChunkMap.cpp \
+    ComicPipeline.cpp \
+    ConcurrencyScheduler.cpp \
     DownloadDialog.cpp \
+    DownloadEngine.cpp \
     DownloadTask.cpp \
     Extractor.cpp \
     Flv.cpp \
+    LiveMonitor.cpp \
     LoginDialog.cpp \
     MainWindow.cpp \
+    MetadataCache.cpp \
+    MirrorProber.cpp \
     MyTabWidget.cpp \
     Network.cpp \
+    NetworkStats.cpp \
+    PlayUrlCache.cpp \
+    PlayUrlResolver.cpp \
     QrCode.cpp \
+    ReplayReply.cpp \
+    ReplayServer.cpp \
+    RetryPolicy.cpp \
     Settings.cpp \
     TaskTable.cpp \
+    UrlClassifier.cpp \
     main.cpp \
     utils.cpp
 
 HEADERS += \
     AboutWidget.h \
+    ApiRateLimiter.h \
+    BandwidthShaper.h \
+    BufferedWriter.h \
+    CbzWriter.h \
+    ChunkMap.h \
+    ComicPipeline.h \
+    ConcurrencyScheduler.h \
     DownloadDialog.h \
+    DownloadEngine.h \
     DownloadTask.h \
     Extractor.h \
     Flv.h \
+    LiveMonitor.h \
     LoginDialog.h \
     MainWindow.h \
+    MetadataCache.h \
+    MirrorProber.h \
     MyTabWidget.h \
     Network.h \
+    NetworkStats.h \
+    PlayUrlCache.h \
+    PlayUrlResolver.h \
     QrCode.h \
+    ReplayReply.h \
+    ReplayServer.h \
+    RetryPolicy.h \
     Settings.h \
     TaskTable.h \
+    UrlClassifier.h \
     utils.h
 
 # Default rules for deployment.
@@ -0,0 +1,250 @@
+#include "BandwidthShaper.h"
+#include "Settings.h"
+#include <QTimer>
+#include <QThread>
+#include <algorithm>
+
+static constexpr int RefillInterval = 100; // ms
+static constexpr int ThrottledHoldTime = 3000; // ms
+
+// tokens are capped to limit * MaxBurstTime, so that an idle client does not burst after resuming.
+// debt of realtime clients is capped the same, so that other clients are not starved for long after them
+static constexpr double MaxBurstTime = 0.5; // second
+
+static int weightOf(BandwidthShaper::Priority priority)
+{
+    switch (priority) {
+    case BandwidthShaper::Priority::Low:
+        return 1;
+    case BandwidthShaper::Priority::High:
+        return 4;
+    default:
+        return 2;
+    }
+}
+
+Q_GLOBAL_STATIC(BandwidthShaper, shaper)
+
+BandwidthShaper *BandwidthShaper::inst()
+{
+    return shaper();
+}
+
+BandwidthShaper::BandwidthShaper(QObject *parent)
+    : QObject(parent)
+{
+    elapsedTimer.start();
+    refillTimer = new QTimer(this);
+    refillTimer->setInterval(RefillInterval);
+    connect(refillTimer, &QTimer::timeout, this, &BandwidthShaper::refill);
+    reloadSettings();
+}
+
+void BandwidthShaper::reloadSettings()
+{
+    QMutexLocker locker(&mutex);
+    auto settings = Settings::inst();
+    globalLimitVal = settings->value("bandwidth/global", 0).toLongLong();
+    perTaskLimitVal = settings->value("bandwidth/perTask", 0).toLongLong();
+
+    schedule.clear();
+    for (auto &item : settings->value("bandwidth/schedule").toStringList()) {
+        // hh:mm-hh:mm=limit
+        auto rangeAndLimit = item.split('=');
+        auto range = rangeAndLimit.first().split('-');
+        if (rangeAndLimit.size() != 2 || range.size() != 2) {
+            continue;
+        }
+        auto from = QTime::fromString(range[0].trimmed(), "hh:mm");
+        auto to = QTime::fromString(range[1].trimmed(), "hh:mm");
+        bool ok;
+        auto limit = rangeAndLimit[1].trimmed().toLongLong(&ok);
+        if (from.isValid() && to.isValid() && ok && limit >= 0) {
+            schedule.append({from, to, limit});
+        }
+    }
+    updateRefillTimer();
+}
+
+qint64 BandwidthShaper::currentGlobalLimit() const
+{
+    QMutexLocker locker(&mutex);
+    if (schedule.isEmpty()) {
+        return globalLimitVal;
+    }
+    auto now = QTime::currentTime();
+    for (auto &item : schedule) {
+        auto inRange = (item.from <= item.to ? (item.from <= now && now < item.to)
+                                             : (item.from <= now || now < item.to)); // across midnight
+        if (inRange) {
+            return item.limit;
+        }
+    }
+    return globalLimitVal;
+}
+
+bool BandwidthShaper::isLimited() const
+{
+    return globalLimitVal > 0 || perTaskLimitVal > 0 || !schedule.isEmpty();
+}
+
+void BandwidthShaper::updateRefillTimer()
+{
+    // clients of download threads register and unregister too
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, &BandwidthShaper::updateRefillTimer, Qt::QueuedConnection);
+        return;
+    }
+    QMutexLocker locker(&mutex);
+    if (isLimited() && !clients.isEmpty()) {
+        if (!refillTimer->isActive()) {
+            lastRefillTime = elapsedTimer.elapsed();
+            refillTimer->start();
+        }
+    } else {
+        refillTimer->stop();
+    }
+}
+
+BandwidthShaper::Client *BandwidthShaper::registerClient(Priority priority)
+{
+    auto client = new Client;
+    client->priority = priority;
+    {
+        QMutexLocker locker(&mutex);
+        clients.append(client);
+    }
+    updateRefillTimer();
+    return client;
+}
+
+void BandwidthShaper::unregisterClient(Client *client)
+{
+    {
+        QMutexLocker locker(&mutex);
+        clients.removeOne(client);
+        delete client;
+    }
+    updateRefillTimer();
+}
+
+qint64 BandwidthShaper::acquire(Client *client, qint64 wanted)
+{
+    QMutexLocker locker(&mutex);
+    if (client->priority == Priority::Realtime) {
+        consume(client, wanted);
+        return wanted;
+    }
+
+    auto globalLimit = currentGlobalLimit();
+    auto granted = wanted;
+    if (globalLimit > 0) {
+        granted = std::min(granted, client->allowance);
+    }
+    if (perTaskLimitVal > 0) {
+        granted = std::min(granted, client->taskTokens);
+    }
+    granted = std::max<qint64>(granted, 0);
+
+    if (globalLimit > 0) {
+        client->allowance -= granted;
+    }
+    if (perTaskLimitVal > 0) {
+        client->taskTokens -= granted;
+    }
+    client->demand = wanted - granted;
+    if (client->demand > 0) {
+        client->lastThrottledTime = elapsedTimer.elapsed();
+    }
+    return granted;
+}
+
+void BandwidthShaper::consume(Client *client, qint64 bytes)
+{
+    QMutexLocker locker(&mutex);
+    if (client->priority == Priority::Realtime) {
+        if (currentGlobalLimit() > 0) {
+            globalBalance -= bytes;
+        }
+        return;
+    }
+    if (currentGlobalLimit() > 0) {
+        client->allowance -= bytes;
+    }
+    if (perTaskLimitVal > 0) {
+        client->taskTokens -= bytes;
+    }
+}
+
+void BandwidthShaper::pause(Client *client)
+{
+    QMutexLocker locker(&mutex);
+    if (client->allowance > 0) {
+        globalBalance += client->allowance;
+    }
+    client->allowance = 0;
+    client->demand = 0;
+}
+
+bool BandwidthShaper::isThrottled(const Client *client) const
+{
+    QMutexLocker locker(&mutex);
+    return client->lastThrottledTime >= 0
+            && elapsedTimer.elapsed() - client->lastThrottledTime < ThrottledHoldTime;
+}
+
+void BandwidthShaper::refill()
+{
+    QMutexLocker locker(&mutex);
+    auto now = elapsedTimer.elapsed();
+    auto dt = (now - lastRefillTime) / 1000.0;
+    lastRefillTime = now;
+
+    if (perTaskLimitVal > 0) {
+        auto maxTokens = static_cast<qint64>(perTaskLimitVal * MaxBurstTime);
+        auto tokens = static_cast<qint64>(perTaskLimitVal * dt);
+        for (auto client : clients) {
+            client->taskTokens = std::min(client->taskTokens + tokens, maxTokens);
+        }
+    }
+
+    auto globalLimit = currentGlobalLimit();
+    if (globalLimit > 0) {
+        auto maxTokens = static_cast<qint64>(globalLimit * MaxBurstTime);
+        globalBalance = std::clamp(globalBalance + static_cast<qint64>(globalLimit * dt), -maxTokens, maxTokens);
+
+        // weighted water-filling: tokens a hungry client can not take are shared by others
+        QList<Client*> hungry;
+        for (auto client : clients) {
+            if (client->priority != Priority::Realtime && client->demand > 0) {
+                hungry.append(client);
+            }
+        }
+        while (globalBalance > 0 && !hungry.isEmpty()) {
+            int totalWeight = 0;
+            for (auto client : hungry) {
+                totalWeight += weightOf(client->priority);
+            }
+            auto pool = globalBalance;
+            for (auto it = hungry.begin(); it != hungry.end(); ) {
+                auto client = *it;
+                auto share = pool * weightOf(client->priority) / totalWeight;
+                auto given = std::min(share, client->demand);
+                client->allowance += given;
+                client->demand -= given;
+                globalBalance -= given;
+                if (client->demand == 0) {
+                    it = hungry.erase(it);
+                } else {
+                    it++;
+                }
+            }
+            if (globalBalance == pool) {
+                break; // remainder of integer division
+            }
+        }
+    }
+
+    locker.unlock();
+    emit refilled();
+}
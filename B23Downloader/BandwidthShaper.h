@@ -0,0 +1,102 @@
+#ifndef BANDWIDTHSHAPER_H
+#define BANDWIDTHSHAPER_H
+
+#include <QObject>
+#include <QTime>
+#include <QElapsedTimer>
+#include <QMutex>
+
+class QTimer;
+
+/**
+ * @brief BandwidthShaper is a token bucket shared by the read path of all download tasks.
+ * Limits (bytes per second, 0 for unlimited) are read from Settings:
+ *   - bandwidth/global:   global limit
+ *   - bandwidth/perTask:  limit of each task
+ *   - bandwidth/schedule: list of "hh:mm-hh:mm=limit" that overrides global limit in the time range
+ * Tokens of global limit are shared by hungry clients in proportion to the weight of their priority.
+ * Realtime clients (live recordings) are never throttled, but the bytes they read are charged
+ * to global limit so that other clients get the rest.
+ * Methods are thread-safe. refilled() is emitted in the thread of BandwidthShaper.
+ *
+ * Usage: read at most acquire() bytes in readyRead slot. If less than available is granted,
+ * read the rest when refilled() is emitted.
+ */
+class BandwidthShaper : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Priority { Low, Normal, High, Realtime };
+
+    struct Client
+    {
+        Priority priority = Priority::Normal;
+        qint64 allowance = 0;     // share of global tokens
+        qint64 taskTokens = 0;    // tokens of per-task limit
+        qint64 demand = 0;        // bytes wanted but not granted at last acquire()
+        qint64 lastThrottledTime = -1;
+    };
+
+    static BandwidthShaper *inst();
+
+    BandwidthShaper(QObject *parent = nullptr);
+
+    Client *registerClient(Priority priority = Priority::Normal);
+    void unregisterClient(Client *client);
+
+    /**
+     * @return number of bytes (<= wanted) the client is allowed to read now
+     */
+    qint64 acquire(Client *client, qint64 wanted);
+
+    /**
+     * @brief charge bytes that have been read regardless of limit
+     */
+    void consume(Client *client, qint64 bytes);
+
+    /**
+     * @brief call when client stops reading (connection finished or task stopped).
+     * allowance it has not used is returned, and it is no longer fed until next acquire()
+     */
+    void pause(Client *client);
+
+    /**
+     * @return whether the client was throttled in the last few seconds.
+     * throughput of a throttled client does not reflect the network condition
+     */
+    bool isThrottled(const Client *client) const;
+
+    void reloadSettings();
+    qint64 currentGlobalLimit() const;
+    qint64 perTaskLimit() const { return perTaskLimitVal; }
+
+signals:
+    void refilled();
+
+private:
+    struct ScheduleItem
+    {
+        QTime from;
+        QTime to;
+        qint64 limit;
+    };
+
+    qint64 globalLimitVal = 0;
+    qint64 perTaskLimitVal = 0;
+    QList<ScheduleItem> schedule;
+
+    mutable QRecursiveMutex mutex;
+
+    QList<Client*> clients;
+    qint64 globalBalance = 0; // negative if realtime clients have consumed more than limit (capped)
+    QTimer *refillTimer;
+    QElapsedTimer elapsedTimer;
+    qint64 lastRefillTime = 0;
+
+    bool isLimited() const;
+    void updateRefillTimer();
+    void refill();
+};
+
+#endif // BANDWIDTHSHAPER_H
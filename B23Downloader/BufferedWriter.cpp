@@ -0,0 +1,107 @@
+#include "BufferedWriter.h"
+#include <QIODevice>
+#include <atomic>
+
+static constexpr qint64 BufferBudgetLimit = 64 * 1024 * 1024;
+
+static std::atomic<qint64> budgetUsedBytes(0);
+
+qint64 BufferBudget::limit()
+{
+    return BufferBudgetLimit;
+}
+
+qint64 BufferBudget::usedBytes()
+{
+    return budgetUsedBytes.load(std::memory_order_relaxed);
+}
+
+bool BufferBudget::isExceeded()
+{
+    return usedBytes() > BufferBudgetLimit;
+}
+
+
+
+BufferedWriter::BufferedWriter(QIODevice *dev)
+    : dev(dev)
+{
+}
+
+BufferedWriter::~BufferedWriter()
+{
+    discard();
+}
+
+void BufferedWriter::setDevice(QIODevice *dev)
+{
+    discard();
+    this->dev = dev;
+    errStr.clear();
+}
+
+void BufferedWriter::updateBudget()
+{
+    qint64 size = buffer.size();
+    budgetUsedBytes.fetch_add(size - accountedBytesCnt, std::memory_order_relaxed);
+    accountedBytesCnt = size;
+}
+
+void BufferedWriter::discard()
+{
+    buffer.clear();
+    updateBudget();
+}
+
+bool BufferedWriter::writeBuffered(qint64 len)
+{
+    if (len <= 0) {
+        return true;
+    }
+    if (dev->write(buffer.constData(), len) != len) {
+        errStr = dev->errorString();
+        return false;
+    }
+    buffer.remove(0, len);
+    return true;
+}
+
+bool BufferedWriter::write(const QByteArray &data)
+{
+    Q_ASSERT(dev != nullptr);
+    if (buffer.isEmpty() && data.size() >= BlockSize && dev->pos() % BlockSize == 0) {
+        // already large enough. write directly without copying
+        auto len = data.size() - data.size() % BlockSize;
+        auto ok = (dev->write(data.constData(), len) == len);
+        if (ok) {
+            buffer.append(data.constData() + len, data.size() - len);
+        } else {
+            errStr = dev->errorString();
+            buffer.append(data);
+        }
+        updateBudget();
+        return ok;
+    }
+
+    buffer.append(data);
+    auto bytesToBoundary = BlockSize - (dev->pos() % BlockSize);
+    bool ok = true;
+    if (buffer.size() >= bytesToBoundary) {
+        auto len = bytesToBoundary + (buffer.size() - bytesToBoundary) / BlockSize * BlockSize;
+        ok = writeBuffered(len);
+    } else if (BufferBudget::isExceeded()) {
+        ok = writeBuffered(buffer.size());
+    }
+    updateBudget();
+    return ok;
+}
+
+bool BufferedWriter::flush()
+{
+    if (dev == nullptr) {
+        return true;
+    }
+    auto ok = writeBuffered(buffer.size());
+    updateBudget();
+    return ok;
+}
@@ -0,0 +1,61 @@
+#ifndef BUFFEREDWRITER_H
+#define BUFFEREDWRITER_H
+
+#include <QByteArray>
+#include <QString>
+
+class QIODevice;
+
+/**
+ * @brief memory budget shared by write buffers of all download tasks
+ */
+namespace BufferBudget
+{
+    qint64 limit();
+    qint64 usedBytes();
+    bool isExceeded();
+}
+
+
+/**
+ * @brief BufferedWriter coalesces data received from network into large blocks before writing to device.
+ * Blocks are aligned to BlockSize (relative to the start of device) except the last one written by flush().
+ * A block is written earlier if BufferBudget is exceeded.
+ */
+class BufferedWriter
+{
+public:
+    static constexpr qint64 BlockSize = 1024 * 1024;
+
+    // used as QNetworkReply::setReadBufferSize() so that a slow disk blocks socket reading
+    static constexpr qint64 ReplyReadBufferSize = 256 * 1024;
+
+    BufferedWriter(QIODevice *dev = nullptr);
+    ~BufferedWriter();
+
+    /**
+     * @brief pending data (if any) is discarded
+     */
+    void setDevice(QIODevice *dev);
+
+    /**
+     * @return false if error occurred (see errorString()). Data not written is kept in buffer.
+     */
+    bool write(const QByteArray &data);
+    bool flush();
+    void discard();
+
+    qint64 pendingBytesCnt() const { return buffer.size(); }
+    QString errorString() const { return errStr; }
+
+private:
+    QIODevice *dev;
+    QByteArray buffer;
+    QString errStr;
+    qint64 accountedBytesCnt = 0; // bytes counted in BufferBudget
+
+    bool writeBuffered(qint64 len);
+    void updateBudget();
+};
+
+#endif // BUFFEREDWRITER_H
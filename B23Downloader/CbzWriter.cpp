@@ -0,0 +1,180 @@
+#include "CbzWriter.h"
+#include <QtEndian>
+#include <QDateTime>
+#include <array>
+
+static constexpr quint32 LocalHeaderSignature = 0x04034b50;
+static constexpr quint32 CentralHeaderSignature = 0x02014b50;
+static constexpr quint32 EndOfCentralDirSignature = 0x06054b50;
+static constexpr int LocalHeaderSize = 30;
+static constexpr quint16 VersionNeeded = 10; // 1.0: stored
+static constexpr quint16 Utf8NameFlag = 1 << 11;
+
+static void appendUInt16(QByteArray &buf, quint16 val)
+{
+    char tmp[2];
+    qToLittleEndian(val, tmp);
+    buf.append(tmp, 2);
+}
+
+static void appendUInt32(QByteArray &buf, quint32 val)
+{
+    char tmp[4];
+    qToLittleEndian(val, tmp);
+    buf.append(tmp, 4);
+}
+
+static quint32 dosDateTime()
+{
+    auto now = QDateTime::currentDateTime();
+    auto date = now.date();
+    auto time = now.time();
+    quint32 dosDate = ((date.year() - 1980) << 9) | (date.month() << 5) | date.day();
+    quint32 dosTime = (time.hour() << 11) | (time.minute() << 5) | (time.second() / 2);
+    return (dosDate << 16) | dosTime;
+}
+
+quint32 CbzWriter::crc32(const QByteArray &data)
+{
+    static const auto table = []{
+        std::array<quint32, 256> t;
+        for (quint32 i = 0; i < 256; i++) {
+            auto c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    quint32 crc = 0xFFFFFFFF;
+    for (auto ch : data) {
+        crc = table[(crc ^ static_cast<quint8>(ch)) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+CbzWriter::CbzWriter(const QString &path)
+    : file(path)
+{
+}
+
+CbzWriter::~CbzWriter() = default;
+
+bool CbzWriter::open()
+{
+    entryList.clear();
+    if (!file.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+    return scanEntries();
+}
+
+bool CbzWriter::scanEntries()
+{
+    // walk through local file headers. sizes are always in local headers as written by addEntry()
+    auto fileSize = file.size();
+    qint64 pos = 0;
+    while (pos + LocalHeaderSize <= fileSize) {
+        file.seek(pos);
+        auto header = file.read(LocalHeaderSize);
+        auto p = header.constData();
+        if (qFromLittleEndian<quint32>(p) != LocalHeaderSignature) {
+            break; // central directory or garbage
+        }
+        auto dateTime = qFromLittleEndian<quint32>(p + 10);
+        auto crc = qFromLittleEndian<quint32>(p + 14);
+        auto compressedSize = qFromLittleEndian<quint32>(p + 18);
+        auto size = qFromLittleEndian<quint32>(p + 22);
+        auto nameLen = qFromLittleEndian<quint16>(p + 26);
+        auto extraLen = qFromLittleEndian<quint16>(p + 28);
+        auto method = qFromLittleEndian<quint16>(p + 8);
+        auto entryEnd = pos + LocalHeaderSize + nameLen + extraLen + compressedSize;
+        if (method != 0 || compressedSize != size || entryEnd > fileSize) {
+            break;
+        }
+        auto name = file.read(nameLen);
+        file.seek(pos + LocalHeaderSize + nameLen + extraLen);
+        if (crc32(file.read(size)) != crc) {
+            break;
+        }
+        entryList.append({name, crc, size, static_cast<quint32>(pos), dateTime});
+        pos = entryEnd;
+    }
+
+    if (!file.resize(pos)) {
+        return false;
+    }
+    return file.seek(pos);
+}
+
+bool CbzWriter::addEntry(const QString &name, const QByteArray &data)
+{
+    auto nameUtf8 = name.toUtf8();
+    Entry entry { nameUtf8, crc32(data), static_cast<quint32>(data.size()), static_cast<quint32>(file.pos()), dosDateTime() };
+
+    QByteArray header;
+    header.reserve(LocalHeaderSize + nameUtf8.size());
+    appendUInt32(header, LocalHeaderSignature);
+    appendUInt16(header, VersionNeeded);
+    appendUInt16(header, Utf8NameFlag);
+    appendUInt16(header, 0); // method: stored
+    appendUInt32(header, entry.dosDateTime);
+    appendUInt32(header, entry.crc32);
+    appendUInt32(header, entry.size); // compressed size
+    appendUInt32(header, entry.size);
+    appendUInt16(header, static_cast<quint16>(nameUtf8.size()));
+    appendUInt16(header, 0); // extra field length
+    header.append(nameUtf8);
+
+    if (file.write(header) != header.size() || file.write(data) != data.size() || !file.flush()) {
+        // remove the partial entry, so that the archive can still be appended
+        file.resize(entry.offset);
+        file.seek(entry.offset);
+        return false;
+    }
+    entryList.append(std::move(entry));
+    return true;
+}
+
+bool CbzWriter::finish()
+{
+    auto centralDirOffset = file.pos();
+    QByteArray centralDir;
+    for (auto &entry : entryList) {
+        appendUInt32(centralDir, CentralHeaderSignature);
+        appendUInt16(centralDir, VersionNeeded); // version made by
+        appendUInt16(centralDir, VersionNeeded);
+        appendUInt16(centralDir, Utf8NameFlag);
+        appendUInt16(centralDir, 0); // method: stored
+        appendUInt32(centralDir, entry.dosDateTime);
+        appendUInt32(centralDir, entry.crc32);
+        appendUInt32(centralDir, entry.size);
+        appendUInt32(centralDir, entry.size);
+        appendUInt16(centralDir, static_cast<quint16>(entry.name.size()));
+        appendUInt16(centralDir, 0); // extra field length
+        appendUInt16(centralDir, 0); // comment length
+        appendUInt16(centralDir, 0); // disk number
+        appendUInt16(centralDir, 0); // internal attributes
+        appendUInt32(centralDir, 0); // external attributes
+        appendUInt32(centralDir, entry.offset);
+        centralDir.append(entry.name);
+    }
+
+    auto centralDirSize = centralDir.size();
+    appendUInt32(centralDir, EndOfCentralDirSignature);
+    appendUInt16(centralDir, 0); // disk number
+    appendUInt16(centralDir, 0); // disk with central directory
+    appendUInt16(centralDir, static_cast<quint16>(entryList.size()));
+    appendUInt16(centralDir, static_cast<quint16>(entryList.size()));
+    appendUInt32(centralDir, static_cast<quint32>(centralDirSize)); // size of central directory
+    appendUInt32(centralDir, static_cast<quint32>(centralDirOffset));
+    appendUInt16(centralDir, 0); // comment length
+
+    if (file.write(centralDir) != centralDir.size() || !file.flush()) {
+        return false;
+    }
+    file.close();
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef CBZWRITER_H
+#define CBZWRITER_H
+
+#include <QFile>
+#include <QList>
+
+/**
+ * @brief CbzWriter writes images into a CBZ (zip archive without compression) entry by entry.
+ * Sizes and CRC-32 are written in local file headers, so that an archive without central directory
+ * (download interrupted) can be scanned and appended to. Central directory is written by finish().
+ * Zip64 is not supported (archive must be smaller than 4 GiB).
+ */
+class CbzWriter
+{
+public:
+    struct Entry
+    {
+        QByteArray name;
+        quint32 crc32;
+        quint32 size;
+        quint32 offset; // of local file header
+        quint32 dosDateTime; // modification time, as in local file header
+    };
+
+    CbzWriter(const QString &path);
+    ~CbzWriter();
+
+    /**
+     * @brief create the archive, or open an existing one and keep its complete entries.
+     * Incomplete data and central directory at the end are truncated.
+     */
+    bool open();
+    bool addEntry(const QString &name, const QByteArray &data);
+
+    /**
+     * @brief write central directory and close the file
+     */
+    bool finish();
+
+    const QList<Entry> &entries() const { return entryList; }
+    QString errorString() const { return file.errorString(); }
+
+    static quint32 crc32(const QByteArray &data);
+
+private:
+    QFile file;
+    QList<Entry> entryList;
+
+    bool scanEntries();
+};
+
+#endif // CBZWRITER_H
@@ -0,0 +1,151 @@
+#include "ChunkMap.h"
+#include <QUrl>
+#include <QtEndian>
+#include <QCryptographicHash>
+
+static constexpr char Magic[] = "B23C";
+static constexpr quint8 Version = 1;
+static constexpr int FingerprintSize = 8;
+static constexpr int HeaderSize = 4 + 1 + 8 + 4 + FingerprintSize;
+
+QString ChunkMap::sidecarPath(const QString &filePath)
+{
+    return filePath + ".chunks";
+}
+
+QByteArray ChunkMap::fingerprint(const QUrl &url, const QString &md5)
+{
+    // host and query (token, deadline...) differ between mirrors and requests
+    auto hash = QCryptographicHash::hash((url.path() + md5).toUtf8(), QCryptographicHash::Sha1);
+    return hash.left(FingerprintSize);
+}
+
+ChunkMap::ChunkMap(const QString &sidecarPath)
+    : file(sidecarPath)
+{
+}
+
+ChunkMap::~ChunkMap() = default;
+
+void ChunkMap::setChunkCount(qint64 totalSize)
+{
+    this->totalSize = totalSize;
+    chunkCnt = static_cast<int>((totalSize + ChunkSize - 1) / ChunkSize);
+}
+
+static QByteArray header(qint64 totalSize, int qn, const QByteArray &fingerprint)
+{
+    QByteArray ret(Magic, 4);
+    ret.append(static_cast<char>(Version));
+    char buf[8];
+    qToBigEndian<qint64>(totalSize, buf);
+    ret.append(buf, 8);
+    qToBigEndian<qint32>(qn, buf);
+    ret.append(buf, 4);
+    ret.append(fingerprint.leftJustified(FingerprintSize, '\0', true));
+    return ret;
+}
+
+bool ChunkMap::load(qint64 totalSize, int qn, const QByteArray &fingerprint)
+{
+    setChunkCount(totalSize);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::ExistingOnly)) {
+        return false;
+    }
+    auto bitmapSize = (chunkCnt + 7) / 8;
+    auto data = file.readAll();
+    if (data.size() != HeaderSize + bitmapSize || !data.startsWith(header(totalSize, qn, fingerprint))) {
+        file.close();
+        return false;
+    }
+    bitmap = data.mid(HeaderSize);
+    return true;
+}
+
+bool ChunkMap::create(qint64 totalSize, int qn, const QByteArray &fingerprint, qint64 completedPrefix)
+{
+    setChunkCount(totalSize);
+    if (file.isOpen()) {
+        file.close();
+    }
+    bitmap = QByteArray((chunkCnt + 7) / 8, '\0');
+    for (int i = 0; i < chunkCnt && chunkEnd(i) <= completedPrefix; i++) {
+        bitmap[i / 8] = static_cast<char>(bitmap[i / 8] | (1 << (i % 8)));
+    }
+
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        return false;
+    }
+    auto data = header(totalSize, qn, fingerprint) + bitmap;
+    if (file.write(data) != data.size() || !file.flush()) {
+        file.close();
+        return false;
+    }
+    return true;
+}
+
+bool ChunkMap::markCompleted(int chunkIndex)
+{
+    auto byteIndex = chunkIndex / 8;
+    auto byte = static_cast<char>(bitmap[byteIndex] | (1 << (chunkIndex % 8)));
+    if (!file.seek(HeaderSize + byteIndex) || !file.putChar(byte) || !file.flush()) {
+        return false;
+    }
+    bitmap[byteIndex] = byte;
+    return true;
+}
+
+void ChunkMap::invalidateBeyond(qint64 fileSize)
+{
+    for (int i = 0; i < chunkCnt; i++) {
+        if (chunkEnd(i) > fileSize) {
+            bitmap[i / 8] = static_cast<char>(bitmap[i / 8] & ~(1 << (i % 8)));
+        }
+    }
+}
+
+void ChunkMap::remove()
+{
+    if (file.isOpen()) {
+        file.close();
+    }
+    file.remove();
+}
+
+qint64 ChunkMap::chunkEnd(int chunkIndex) const
+{
+    return std::min((chunkIndex + 1) * ChunkSize, totalSize);
+}
+
+bool ChunkMap::isCompleted(int chunkIndex) const
+{
+    return bitmap[chunkIndex / 8] & (1 << (chunkIndex % 8));
+}
+
+qint64 ChunkMap::completedBytesCnt() const
+{
+    qint64 ret = 0;
+    for (int i = 0; i < chunkCnt; i++) {
+        if (isCompleted(i)) {
+            ret += chunkEnd(i) - i * ChunkSize;
+        }
+    }
+    return ret;
+}
+
+QList<ChunkMap::Range> ChunkMap::holes() const
+{
+    QList<Range> ret;
+    for (int i = 0; i < chunkCnt; i++) {
+        if (isCompleted(i)) {
+            continue;
+        }
+        auto begin = i * ChunkSize;
+        if (!ret.isEmpty() && ret.last().second == begin) {
+            ret.last().second = chunkEnd(i);
+        } else {
+            ret.append({begin, chunkEnd(i)});
+        }
+    }
+    return ret;
+}
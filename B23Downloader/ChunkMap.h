@@ -0,0 +1,77 @@
+#ifndef CHUNKMAP_H
+#define CHUNKMAP_H
+
+#include <QFile>
+#include <QList>
+
+class QUrl;
+
+/**
+ * @brief ChunkMap records which fixed-size chunks of a download are completely written to disk.
+ * It is kept in a sidecar file next to the downloaded file:
+ *   magic (4 bytes) | version (UInt8) | total size (Int64) | qn (Int32) | fingerprint (8 bytes) | bitmap
+ * Marking a chunk completed rewrites a single byte of the bitmap.
+ */
+class ChunkMap
+{
+public:
+    static constexpr qint64 ChunkSize = 4 * 1024 * 1024; // multiple of BufferedWriter::BlockSize
+
+    using Range = std::pair<qint64, qint64>; // [begin, end)
+
+    static QString sidecarPath(const QString &filePath);
+
+    /**
+     * @brief fingerprint of the file on CDN. Mirrors of the same file share the same fingerprint.
+     * @param md5 hash of the file provided by API, may be empty
+     */
+    static QByteArray fingerprint(const QUrl &url, const QString &md5);
+
+    ChunkMap(const QString &sidecarPath);
+    ~ChunkMap();
+
+    /**
+     * @return true if sidecar file exists and matches the arguments
+     */
+    bool load(qint64 totalSize, int qn, const QByteArray &fingerprint);
+
+    /**
+     * @brief create (or overwrite) sidecar file. Chunks entirely in [0, completedPrefix) are marked completed.
+     */
+    bool create(qint64 totalSize, int qn, const QByteArray &fingerprint, qint64 completedPrefix = 0);
+
+    /**
+     * @return false if failed to write sidecar file, in which case the chunk is left not completed
+     */
+    bool markCompleted(int chunkIndex);
+
+    /**
+     * @brief mark chunks that exceed fileSize as not completed (in memory only).
+     */
+    void invalidateBeyond(qint64 fileSize);
+
+    /**
+     * @brief close and delete the sidecar file
+     */
+    void remove();
+
+    int chunkCount() const { return chunkCnt; }
+    qint64 chunkEnd(int chunkIndex) const;
+    bool isCompleted(int chunkIndex) const;
+    qint64 completedBytesCnt() const;
+
+    /**
+     * @return byte ranges of chunks not completed. Adjacent chunks are merged.
+     */
+    QList<Range> holes() const;
+
+private:
+    QFile file;
+    qint64 totalSize = 0;
+    int chunkCnt = 0;
+    QByteArray bitmap;
+
+    void setChunkCount(qint64 totalSize);
+};
+
+#endif // CHUNKMAP_H
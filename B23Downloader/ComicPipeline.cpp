@@ -0,0 +1,73 @@
+#include "ComicPipeline.h"
+#include "Settings.h"
+#include <QNetworkReply>
+#include <QThreadStorage>
+
+static constexpr int DefaultMaxImgFetchCnt = 8;
+
+static QThreadStorage<ComicPipeline*> pipelines;
+
+ComicPipeline *ComicPipeline::inst()
+{
+    if (!pipelines.hasLocalData()) {
+        pipelines.setLocalData(new ComicPipeline);
+    }
+    return pipelines.localData();
+}
+
+// settings are read on first call, which is in GUI thread (by TaskTable)
+static std::pair<bool, int> settings()
+{
+    static const std::pair<bool, int> values {
+        Settings::inst()->value("comic/batchMode", true).toBool(),
+        std::max(Settings::inst()->value("comic/maxImgFetches", DefaultMaxImgFetchCnt).toInt(), 1)
+    };
+    return values;
+}
+
+bool ComicPipeline::isBatchMode()
+{
+    return settings().first;
+}
+
+ComicPipeline::ComicPipeline(QObject *parent)
+    : QObject(parent), maxImgFetchCnt(settings().second)
+{
+}
+
+void ComicPipeline::queueIndexRequest(QObject *requester, std::function<QNetworkReply*()> sendRequest)
+{
+    indexQueue.append({requester, std::move(sendRequest)});
+    sendIndexRequests();
+}
+
+void ComicPipeline::cancelIndexRequest(QObject *requester)
+{
+    indexQueue.removeIf([requester](auto &item){ return item.first == requester; });
+}
+
+void ComicPipeline::sendIndexRequests()
+{
+    while (indexRequestCnt < MaxIndexRequestsInFlight && !indexQueue.isEmpty()) {
+        auto [requester, sendRequest] = indexQueue.takeFirst();
+        if (requester.isNull()) {
+            continue;
+        }
+        auto reply = sendRequest();
+        indexRequestCnt++;
+        connect(reply, &QNetworkReply::finished, this, [this]{
+            indexRequestCnt--;
+            // may be finished by abort() of a task being stopped. send next later
+            QMetaObject::invokeMethod(this, &ComicPipeline::sendIndexRequests, Qt::QueuedConnection);
+        });
+    }
+}
+
+void ComicPipeline::addImgFetch(QNetworkReply *reply)
+{
+    imgFetchCnt++;
+    connect(reply, &QNetworkReply::finished, this, [this]{
+        imgFetchCnt--;
+        emit imgFetchSlotReleased();
+    });
+}
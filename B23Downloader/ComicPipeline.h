@@ -0,0 +1,63 @@
+#ifndef COMICPIPELINE_H
+#define COMICPIPELINE_H
+
+#include <QObject>
+#include <QPointer>
+#include <functional>
+
+class QNetworkReply;
+
+/**
+ * @brief ComicPipeline is shared by comic tasks in batch mode (Settings "comic/batchMode", default on),
+ * in which comic tasks are started without taking a concurrency slot of TaskTable:
+ *   - image index requests of started chapters are queued and sent ahead, a few at a time
+ *   - images of all chapters are downloaded in one pool of "comic/maxImgFetches" slots.
+ *     chapters started first are served first, and the next chapter takes the slots left
+ *     by the chapter before it, with its index and image tokens already fetched
+ * The settings are read once at startup. Each thread running comic tasks has its own pipeline
+ * (DownloadEngine puts all comic tasks in one thread).
+ */
+class ComicPipeline : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int MaxIndexRequestsInFlight = 2;
+
+    /**
+     * @return pipeline of current thread
+     */
+    static ComicPipeline *inst();
+    static bool isBatchMode();
+
+    ComicPipeline(QObject *parent = nullptr);
+
+    /**
+     * @brief sendRequest is called when its turn comes. the returned reply takes a slot until finished
+     */
+    void queueIndexRequest(QObject *requester, std::function<QNetworkReply*()> sendRequest);
+    void cancelIndexRequest(QObject *requester);
+
+    bool hasFreeImgFetchSlot() const { return imgFetchCnt < maxImgFetchCnt; }
+
+    /**
+     * @brief the image download takes a slot until the reply is finished (or aborted)
+     */
+    void addImgFetch(QNetworkReply *reply);
+
+signals:
+    /**
+     * @brief emitted when a slot is freed. receivers connected first are notified first
+     */
+    void imgFetchSlotReleased();
+
+private:
+    int maxImgFetchCnt;
+    int imgFetchCnt = 0;
+    int indexRequestCnt = 0;
+    QList<std::pair<QPointer<QObject>, std::function<QNetworkReply*()>>> indexQueue;
+
+    void sendIndexRequests();
+};
+
+#endif // COMICPIPELINE_H
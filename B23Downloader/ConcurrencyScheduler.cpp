@@ -0,0 +1,121 @@
+#include "ConcurrencyScheduler.h"
+#include "DownloadTask.h"
+#include "BandwidthShaper.h"
+#include "Settings.h"
+#include <algorithm>
+
+static constexpr int MinConcurrency = 1;
+static constexpr int DefaultConcurrency = 3;
+static constexpr int DefaultMaxConcurrency = 8;
+
+static constexpr int PeriodSampleCount = 5; // 10s per evaluation period
+static constexpr int HoldPeriodCount = 6;   // periods to wait before probing a higher limit again
+
+static constexpr double GainThreshold = 0.1;  // raising the limit must gain 10% throughput
+static constexpr double DropThreshold = 0.3;  // a drop of 30% is treated as congestion
+
+ConcurrencyScheduler::ConcurrencyScheduler(QObject *parent)
+    : QObject(parent)
+{
+    auto settings = Settings::inst();
+    maxLimit = std::max(settings->value("download/maxConcurrency", DefaultMaxConcurrency).toInt(), MinConcurrency);
+    limit = std::clamp(settings->value("download/concurrency", DefaultConcurrency).toInt(), MinConcurrency, maxLimit);
+}
+
+void ConcurrencyScheduler::setLimit(int newLimit)
+{
+    newLimit = std::clamp(newLimit, MinConcurrency, maxLimit);
+    if (newLimit == limit) {
+        return;
+    }
+    qDebug() << "concurrency:" << limit << "->" << newLimit;
+    limit = newLimit;
+    Settings::inst()->setValue("download/concurrency", limit);
+    emit concurrencyChanged(limit);
+}
+
+void ConcurrencyScheduler::addSample(const QList<const AbstractDownloadTask*> &activeTasks, bool hasWaitingTasks)
+{
+    QHash<const AbstractDownloadTask*, qint64> bytesCnt;
+    for (auto task : activeTasks) {
+        auto cnt = task->getSnapshot().downloadedBytesCnt; // task may live in a download thread
+        bytesCnt.insert(task, cnt);
+        auto it = lastBytesCnt.constFind(task);
+        if (it != lastBytesCnt.constEnd()) {
+            // bytes count may go back if a task restarts
+            periodBytesCnt += std::max<qint64>(cnt - it.value(), 0);
+        }
+    }
+    lastBytesCnt.swap(bytesCnt);
+
+    if (activeTasks.size() < limit && !hasWaitingTasks) {
+        periodSaturated = false;
+    }
+    periodSampleCnt++;
+    if (periodSampleCnt < PeriodSampleCount) {
+        return;
+    }
+
+    auto rate = periodBytesCnt / (PeriodSampleCount * SampleInterval / 1000.0);
+    if (periodSaturated) {
+        evaluate(rate, hasWaitingTasks);
+    } else {
+        // not enough tasks to tell whether the limit matters
+        lastRate = -1;
+        direction = 0;
+    }
+    periodBytesCnt = 0;
+    periodSampleCnt = 0;
+    periodSaturated = true;
+}
+
+void ConcurrencyScheduler::evaluate(double rate, bool hasWaitingTasks)
+{
+    if (holdPeriodCnt > 0) {
+        holdPeriodCnt--;
+    }
+    auto prevRate = lastRate;
+    lastRate = rate;
+    if (prevRate < 0) {
+        return;
+    }
+
+    if (direction == 1) {
+        if (rate > prevRate * (1 + GainThreshold) && hasWaitingTasks) {
+            setLimit(limit + 1);
+        } else if (rate <= prevRate * (1 + GainThreshold)) {
+            // no gain: the link is saturated already
+            setLimit(limit - 1);
+            direction = 0;
+            holdPeriodCnt = HoldPeriodCount;
+            lastRate = -1;
+        } else {
+            direction = 0;
+        }
+        return;
+    }
+
+    if (direction == -1) {
+        if (rate < prevRate * (1 - GainThreshold)) {
+            // lowering the limit hurts, the drop was not congestion
+            setLimit(limit + 1);
+            holdPeriodCnt = HoldPeriodCount;
+            lastRate = -1;
+        }
+        direction = 0;
+        return;
+    }
+
+    if (rate < prevRate * (1 - DropThreshold) && limit > MinConcurrency) {
+        setLimit(limit - 1);
+        direction = -1;
+        return;
+    }
+
+    auto globalLimit = BandwidthShaper::inst()->currentGlobalLimit();
+    auto bandwidthBound = (globalLimit > 0 && rate >= globalLimit * (1 - GainThreshold));
+    if (hasWaitingTasks && holdPeriodCnt == 0 && limit < maxLimit && !bandwidthBound) {
+        setLimit(limit + 1);
+        direction = 1;
+    }
+}
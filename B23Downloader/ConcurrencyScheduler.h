@@ -0,0 +1,54 @@
+#ifndef CONCURRENCYSCHEDULER_H
+#define CONCURRENCYSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+
+class AbstractDownloadTask;
+
+/**
+ * @brief ConcurrencyScheduler decides how many (non-live) tasks may download at the same time.
+ * Aggregate throughput is measured over evaluation periods; the limit is raised by one while that
+ * improves throughput, lowered back if it does not, and lowered when throughput drops sharply.
+ * Live recordings are not limited and should not be sampled.
+ * Range of the limit is [1, Settings "download/maxConcurrency"]; the learned limit is saved.
+ */
+class ConcurrencyScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int SampleInterval = 2000; // ms
+
+    ConcurrencyScheduler(QObject *parent = nullptr);
+
+    int concurrency() const { return limit; }
+
+    /**
+     * @brief call every SampleInterval ms
+     * @param activeTasks tasks downloading now (live tasks excluded)
+     * @param hasWaitingTasks whether tasks are waiting for a slot
+     */
+    void addSample(const QList<const AbstractDownloadTask*> &activeTasks, bool hasWaitingTasks);
+
+signals:
+    void concurrencyChanged(int concurrency);
+
+private:
+    int limit;
+    int maxLimit;
+
+    QHash<const AbstractDownloadTask*, qint64> lastBytesCnt;
+    qint64 periodBytesCnt = 0;
+    int periodSampleCnt = 0;
+    bool periodSaturated = true; // all slots were used in this period
+
+    double lastRate = -1; // bytes per sec in last period, -1 if unknown
+    int direction = 0;    // last change of limit: 1 (raised), -1 (lowered) or 0
+    int holdPeriodCnt = 0;
+
+    void evaluate(double rate, bool hasWaitingTasks);
+    void setLimit(int newLimit);
+};
+
+#endif // CONCURRENCYSCHEDULER_H
@@ -0,0 +1,130 @@
+#include "DownloadEngine.h"
+#include "DownloadTask.h"
+#include "Settings.h"
+#include <QThread>
+#include <QTimer>
+#include <QPointer>
+#include <algorithm>
+
+static constexpr int DefaultThreadCnt = 1;
+static constexpr int MaxThreadCnt = 8;
+
+/**
+ * @brief lives in a download thread and refreshes snapshots of tasks in the thread
+ */
+class EngineWorker : public QObject
+{
+public:
+    QList<QPointer<AbstractDownloadTask>> tasks;
+
+    EngineWorker()
+    {
+        timer = new QTimer(this);
+        timer->setInterval(DownloadEngine::SnapshotInterval);
+        connect(timer, &QTimer::timeout, this, &EngineWorker::refreshSnapshots);
+    }
+
+    void start()
+    {
+        timer->start();
+    }
+
+    void refreshSnapshots()
+    {
+        tasks.removeAll(nullptr);
+        for (auto &task : tasks) {
+            task->refreshSnapshot();
+        }
+    }
+
+private:
+    QTimer *timer;
+};
+
+Q_GLOBAL_STATIC(DownloadEngine, engine)
+
+DownloadEngine *DownloadEngine::inst()
+{
+    return engine();
+}
+
+DownloadEngine::DownloadEngine(QObject *parent)
+    : QObject(parent)
+{
+    auto threadCnt = Settings::inst()->value("engine/threads", DefaultThreadCnt).toInt();
+    threadCnt = std::clamp(threadCnt, 0, MaxThreadCnt);
+    for (int i = 0; i < threadCnt; i++) {
+        auto thread = new QThread(this);
+        thread->setObjectName(QStringLiteral("download-%1").arg(i));
+        auto worker = new EngineWorker;
+        worker->moveToThread(thread);
+        connect(thread, &QThread::started, worker, &EngineWorker::start);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        thread->start();
+        threads.append(thread);
+        workers.append(worker);
+    }
+}
+
+DownloadEngine::~DownloadEngine()
+{
+    shutdown();
+}
+
+void DownloadEngine::adopt(AbstractDownloadTask *task)
+{
+    if (threads.isEmpty()) {
+        return;
+    }
+
+    int idx;
+    if (qobject_cast<ComicDownloadTask*>(task) != nullptr) {
+        idx = 0;
+    } else {
+        idx = nextThreadIdx;
+        nextThreadIdx = (nextThreadIdx + 1) % threads.size();
+    }
+
+    // UI reads the snapshot before the first refresh in download thread
+    task->refreshSnapshot();
+
+    // refreshed before queued signals are delivered to UI, as this is connected before UI connects
+    auto refresh = [task]{ task->refreshSnapshot(); };
+    connect(task, &AbstractDownloadTask::getUrlInfoFinished, task, refresh, Qt::DirectConnection);
+    connect(task, &AbstractDownloadTask::downloadFinished, task, refresh, Qt::DirectConnection);
+    connect(task, &AbstractDownloadTask::errorOccurred, task, refresh, Qt::DirectConnection);
+
+    task->moveToThread(threads[idx]);
+    auto worker = workers[idx];
+    QMetaObject::invokeMethod(worker, [worker, task]{ worker->tasks.append(task); });
+}
+
+void DownloadEngine::destroy(AbstractDownloadTask *task)
+{
+    if (task->thread() == QThread::currentThread()) {
+        delete task;
+    } else {
+        task->deleteLater();
+    }
+}
+
+void DownloadEngine::sync()
+{
+    for (auto worker : workers) {
+        QMetaObject::invokeMethod(worker, &EngineWorker::refreshSnapshots, Qt::BlockingQueuedConnection);
+    }
+}
+
+void DownloadEngine::shutdown()
+{
+    // deferred deletes (tasks, replies and workers) are done when a thread finishes
+    for (auto thread : threads) {
+        thread->quit();
+    }
+    for (auto thread : threads) {
+        thread->wait();
+    }
+    workers.clear();
+    qDeleteAll(threads);
+    threads.clear();
+}
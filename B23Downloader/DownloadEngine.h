@@ -0,0 +1,58 @@
+#ifndef DOWNLOADENGINE_H
+#define DOWNLOADENGINE_H
+
+#include <QObject>
+#include <QList>
+
+class QThread;
+class AbstractDownloadTask;
+class EngineWorker;
+
+/**
+ * @brief DownloadEngine runs download tasks in download threads (Settings "engine/threads",
+ * default 1; 0 to run tasks in GUI thread), so that reading replies, writing files and remuxing
+ * do not compete with painting. Each thread has its own QNetworkAccessManager (see Network::accessManager()).
+ *
+ * UI talks to a task only through queued calls (QMetaObject::invokeMethod()) and its signals,
+ * and reads its state from snapshots (AbstractDownloadTask::getSnapshot()) refreshed in download threads
+ * every SnapshotInterval ms and when the task emits a signal.
+ */
+class DownloadEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int SnapshotInterval = 500; // ms
+
+    static DownloadEngine *inst();
+
+    DownloadEngine(QObject *parent = nullptr);
+    ~DownloadEngine();
+
+    /**
+     * @brief move task (not started yet) to a download thread. comic tasks share one thread (see ComicPipeline)
+     */
+    void adopt(AbstractDownloadTask *task);
+
+    /**
+     * @brief delete task in its thread, after calls queued before
+     */
+    static void destroy(AbstractDownloadTask *task);
+
+    /**
+     * @brief block until calls queued to download threads are done and snapshots are refreshed
+     */
+    void sync();
+
+    /**
+     * @brief stop download threads. tasks left are deleted in their threads
+     */
+    void shutdown();
+
+private:
+    QList<QThread*> threads;
+    QList<EngineWorker*> workers;
+    int nextThreadIdx = 0;
+};
+
+#endif // DOWNLOADENGINE_H
@@ -5,6 +5,13 @@
 #include "Network.h"
 #include "utils.h"
 #include "Flv.h"
+#include "MirrorProber.h"
+#include "ChunkMap.h"
+#include "BandwidthShaper.h"
+#include "PlayUrlCache.h"
+#include "CbzWriter.h"
+#include "ComicPipeline.h"
+#include "Settings.h"
 #include <QtNetwork>
 
 // 127: 8K 超高清
@@ -21,6 +28,28 @@ static QMap<int, QString> videoQnDescMap {
     {16, "360P 流畅"},
 };
 
+// switch to next mirror if throughput is below MirrorSwitchBytesPerSec for MirrorCheckWindow seconds
+static constexpr qint64 MirrorSwitchBytesPerSec = 256 * 1024;
+static constexpr int MirrorCheckWindow = 10;
+static constexpr int ThroughputTimerInterval = 1000; // ms
+
+// bytes before resume point fetched again and compared with file
+static constexpr qint64 ResumeVerifyBytesCnt = 64 * 1024;
+
+// a connection is stalled if no data arrives for StallTimeout, or if throughput is below
+// StallBytesPerSec for MirrorCheckWindow seconds and there is no mirror to switch to
+static constexpr int StallTimeout = 20000; // ms
+static constexpr qint64 StallBytesPerSec = 4 * 1024;
+
+// reconnect delay is doubled after each failed reconnect, reset once data arrives
+static constexpr int ReconnectBaseDelay = 1000; // ms
+static constexpr int MaxReconnectDelay = 60000; // ms
+static constexpr int MaxConsecutiveReconnectCount = 6;
+
+// live stream is reconnected immediately after it ends, then with delay doubled after each failure
+static constexpr int LiveReconnectBaseDelay = 500; // ms
+static constexpr int MaxLiveReconnectCount = 5;
+
 static QMap<int, QString> liveQnDescMap {
     {10000, "原画"},
     {400, "蓝光"},
@@ -53,11 +82,35 @@ inline bool jsonValue2Bool(const QJsonValue &val, bool defaultVal = false) {
 }
 
 
+AbstractDownloadTask::AbstractDownloadTask(const QString &path)
+    : path(path)
+{
+    shaperClient = BandwidthShaper::inst()->registerClient();
+
+    // runId is read in the thread of the task when emitted, not when delivered
+    connect(this, &AbstractDownloadTask::downloadFinished, this, [this]{
+        emit runFinished(runId);
+    }, Qt::DirectConnection);
+    connect(this, &AbstractDownloadTask::errorOccurred, this, [this](const QString &errorString) {
+        emit runErrorOccurred(runId, errorString);
+    }, Qt::DirectConnection);
+    connect(this, &AbstractDownloadTask::getUrlInfoFinished, this, [this]{
+        emit runGetUrlInfoFinished(runId);
+    }, Qt::DirectConnection);
+}
+
+void AbstractDownloadTask::startRun(int runId)
+{
+    this->runId = runId;
+    startDownload();
+}
+
 AbstractDownloadTask::~AbstractDownloadTask()
 {
     if (httpReply != nullptr) {
         httpReply->abort();
     }
+    BandwidthShaper::inst()->unregisterClient(shaperClient);
 }
 
 QString AbstractDownloadTask::getTitle() const
@@ -65,6 +118,51 @@ QString AbstractDownloadTask::getTitle() const
     return QFileInfo(path).baseName();
 }
 
+AbstractDownloadTask::Snapshot AbstractDownloadTask::takeSnapshot() const
+{
+    Snapshot ret;
+    ret.path = path;
+    ret.title = getTitle();
+    ret.qnDescription = getQnDescription();
+    ret.progressStr = getProgressStr();
+    ret.progress = getProgress();
+    ret.downloadedBytesCnt = getDownloadedBytesCnt();
+    ret.bufferedBytesCnt = getBufferedBytesCnt();
+    ret.remainingSeconds = estimateRemainingSeconds(downRate.load(std::memory_order_relaxed));
+    ret.stallCnt = getStallCnt();
+    ret.reconnectCnt = getReconnectCnt();
+    ret.reconnecting = isReconnecting();
+    ret.lastReconnectLatency = getLastReconnectLatency();
+    ret.lastReconnectGap = getLastReconnectGap();
+    ret.json = toJsonObj();
+    return ret;
+}
+
+AbstractDownloadTask::Snapshot AbstractVideoDownloadTask::takeSnapshot() const
+{
+    auto ret = AbstractDownloadTask::takeSnapshot();
+    ret.playUrlCacheKey = playUrlCacheKey();
+    ret.playUrlInfoUrl = getPlayUrlInfoUrl();
+    ret.playUrlInfoDataKey = getPlayUrlInfoDataKey();
+    return ret;
+}
+
+AbstractDownloadTask::Snapshot AbstractDownloadTask::getSnapshot() const
+{
+    if (thread() == QThread::currentThread()) {
+        return takeSnapshot();
+    }
+    QMutexLocker locker(&snapshotMutex);
+    return snapshot;
+}
+
+void AbstractDownloadTask::refreshSnapshot()
+{
+    auto newSnapshot = takeSnapshot();
+    QMutexLocker locker(&snapshotMutex);
+    snapshot = std::move(newSnapshot);
+}
+
 AbstractDownloadTask *AbstractDownloadTask::fromJsonObj(const QJsonObject &json)
 {
     int type = json["type"].toInt(-1);
@@ -115,23 +213,52 @@ qint64 AbstractVideoDownloadTask::getDownloadedBytesCnt() const
     return downloadedBytesCnt;
 }
 
+QString AbstractVideoDownloadTask::playUrlCacheKey() const
+{
+    // urls (and quality available) differ between users and between logged in or not
+    auto key = getPlayUrlInfoCacheKey();
+    if (!key.isEmpty()) {
+        auto uid = Settings::inst()->getCookieJar()->getCookie("DedeUserID");
+        key += "/" + QString::fromLatin1(uid);
+    }
+    return key;
+}
+
 void AbstractVideoDownloadTask::startDownload()
 {
+    playUrlInfoCacheKey = playUrlCacheKey();
+    auto cached = PlayUrlCache::inst()->get(playUrlInfoCacheKey);
+    isPlayUrlInfoCached = !cached.isEmpty();
+    if (isPlayUrlInfoCached) {
+        // parsed later like a reply, as errors emitted synchronously would reenter the caller
+        auto id = ++cacheHitId;
+        QMetaObject::invokeMethod(this, [this, id, cached]{
+            if (id == cacheHitId) {
+                parsePlayUrlInfo(cached);
+            }
+        }, Qt::QueuedConnection);
+        return;
+    }
+
     httpReply = getPlayUrlInfo();
     connect(httpReply, &QNetworkReply::finished, this, [this]{
         auto data = getReplyJson(getPlayUrlInfoDataKey()).toObject();
         if (data.isEmpty()) {
             return;
         }
+        PlayUrlCache::inst()->insert(playUrlInfoCacheKey, data);
         parsePlayUrlInfo(data);
     });
 }
 
+
 void AbstractVideoDownloadTask::stopDownload()
 {
+    cacheHitId++;
     if (httpReply != nullptr) {
         httpReply->abort();
     }
+    BandwidthShaper::inst()->pause(shaperClient);
 }
 
 
@@ -141,8 +268,9 @@ QJsonObject VideoDownloadTask::toJsonObj() const
     return QJsonObject{
         {"path", path},
         {"qn", qn},
-        {"bytes", downloadedBytesCnt},
-        {"total", totalBytesCnt}
+        {"bytes", downloadedBytesCnt - writer.pendingBytesCnt()},
+        {"total", totalBytesCnt},
+        {"chunked", hasChunkMap}
     };
 }
 
@@ -151,11 +279,25 @@ VideoDownloadTask::VideoDownloadTask(const QJsonObject &json)
 {
     downloadedBytesCnt = json["bytes"].toInteger(0);
     totalBytesCnt = json["total"].toInteger(0);
+    hasChunkMap = json["chunked"].toBool(false);
+}
+
+VideoDownloadTask::~VideoDownloadTask() = default;
+
+void VideoDownloadTask::stopDownload()
+{
+    mirrorProber.reset();
+    if (isReconnecting()) {
+        reconnectTimer->stop();
+        closeFile();
+    }
+    AbstractVideoDownloadTask::stopDownload();
 }
 
 void VideoDownloadTask::removeFile()
 {
     QFile::remove(path);
+    QFile::remove(ChunkMap::sidecarPath(path));
 }
 
 int VideoDownloadTask::estimateRemainingSeconds(qint64 downBytesPerSec) const
@@ -175,6 +317,16 @@ double VideoDownloadTask::getProgress() const
     return static_cast<double>(downloadedBytesCnt) / totalBytesCnt;
 }
 
+qint64 VideoDownloadTask::getBufferedBytesCnt() const
+{
+    return writer.pendingBytesCnt();
+}
+
+bool VideoDownloadTask::isReconnecting() const
+{
+    return reconnectTimer != nullptr && reconnectTimer->isActive();
+}
+
 QString VideoDownloadTask::getProgressStr() const
 {
     if (totalBytesCnt == 0) {
@@ -244,6 +396,15 @@ bool VideoDownloadTask::checkSize(qint64 sizeFromReply)
     return true;
 }
 
+QList<QUrl> VideoDownloadTask::mirrorsOfDurl(const QJsonObject &durlObj)
+{
+    QList<QUrl> ret { QUrl(durlObj["url"].toString()) };
+    for (auto &&urlValR : durlObj["backup_url"].toArray()) {
+        ret.append(QUrl(urlValR.toString()));
+    }
+    return ret;
+}
+
 void VideoDownloadTask::parsePlayUrlInfo(const QJsonObject &data)
 {
     if (jsonValue2Bool(data["is_preview"], 0)) {
@@ -276,7 +437,21 @@ void VideoDownloadTask::parsePlayUrlInfo(const QJsonObject &data)
     }
 
     durationInMSec = durlObj["length"].toInt();
-    startDownloadStream(durlObj["url"].toString());
+    fileMd5 = durlObj["md5"].toString();
+
+    mirrors = mirrorsOfDurl(durlObj);
+    if (mirrors.size() == 1) {
+        startDownloadStream();
+        return;
+    }
+
+    mirrorProber = std::make_unique<MirrorProber>(mirrors);
+    connect(mirrorProber.get(), &MirrorProber::finished, this, [this](const QList<QUrl> &rankedMirrors) {
+        mirrorProber.release()->deleteLater();
+        mirrors = rankedMirrors;
+        startDownloadStream();
+    });
+    mirrorProber->start();
 }
 
 std::unique_ptr<QFile> VideoDownloadTask::openFileForWrite()
@@ -296,39 +471,234 @@ std::unique_ptr<QFile> VideoDownloadTask::openFileForWrite()
         emit errorOccurred("打开文件失败");
         return nullptr;
     }
+    return file;
+}
 
-    auto fileSize = file->size();
-    if (fileSize < downloadedBytesCnt) {
-        qDebug() << QString("filesize(%1) < bytes(%2)").arg(fileSize).arg(downloadedBytesCnt);
-        downloadedBytesCnt = fileSize;
+bool VideoDownloadTask::prepareChunkMap()
+{
+    auto fingerprint = ChunkMap::fingerprint(mirrors.first(), fileMd5);
+    chunkMap = std::make_unique<ChunkMap>(ChunkMap::sidecarPath(path));
+    auto fileSize = QFileInfo(path).size();
+    if (!chunkMap->load(totalBytesCnt, qn, fingerprint)) {
+        // tasks saved by earlier versions have no chunk map, but a downloaded prefix
+        auto prefix = (hasChunkMap ? 0 : std::min(downloadedBytesCnt, fileSize));
+        if (!chunkMap->create(totalBytesCnt, qn, fingerprint, prefix)) {
+            chunkMap.reset();
+            emit errorOccurred("创建分块记录文件失败");
+            return false;
+        }
+        hasChunkMap = true;
     }
-    file->seek(downloadedBytesCnt);
-    return file;
+
+    chunkMap->invalidateBeyond(fileSize);
+    pendingRanges = chunkMap->holes();
+    downloadedBytesCnt = chunkMap->completedBytesCnt();
+    return true;
 }
 
-void VideoDownloadTask::startDownloadStream(const QUrl &url)
+void VideoDownloadTask::startDownloadStream()
 {
     emit getUrlInfoFinished();
 
     // check extension of filename
-    auto ext = Utils::fileExtension(url.fileName());
+    auto ext = Utils::fileExtension(mirrors.first().fileName());
     if (downloadedBytesCnt == 0 && !path.endsWith(ext, Qt::CaseInsensitive)) {
         path.append(ext);
     }
 
+    if (!prepareChunkMap()) {
+        return;
+    }
+    if (pendingRanges.isEmpty()) {
+        chunkMap->remove();
+        chunkMap.reset();
+        emit downloadFinished();
+        return;
+    }
     file = openFileForWrite();
     if (!file) {
         return;
     }
+    writer.setDevice(file.get());
+
+    if (throughputTimer == nullptr) {
+        throughputTimer = new QTimer(this);
+        throughputTimer->setInterval(ThroughputTimerInterval);
+        connect(throughputTimer, &QTimer::timeout, this, &VideoDownloadTask::checkThroughput);
+    }
+    throughputWindow.clear();
+    throughputTimer->start();
+    lastCheckedBytesCnt = downloadedBytesCnt;
+    noProgressTicks = 0;
+    consecutiveReconnectCnt = 0;
+
+    mirrorIndex = 0;
+    verifyWindows = resumeVerifyWindows();
+    if (!verifyWindows.isEmpty()) {
+        verifyResume();
+    } else {
+        startNextRange();
+    }
+}
+
+void VideoDownloadTask::closeFile()
+{
+    throughputTimer->stop();
+    writer.setDevice(nullptr);
+    file.reset();
+}
+
+QList<std::pair<qint64, qint64>> VideoDownloadTask::resumeVerifyWindows() const
+{
+    int n = chunkMap->chunkCount();
+    int first = 0;
+    while (first < n && !chunkMap->isCompleted(first)) {
+        first++;
+    }
+    if (first == n) {
+        return {};
+    }
+    int last = n - 1;
+    while (!chunkMap->isCompleted(last)) {
+        last--;
+    }
+
+    auto begin = first * ChunkMap::ChunkSize;
+    auto end = chunkMap->chunkEnd(last);
+    if (last == first && end - begin <= 2 * ResumeVerifyBytesCnt) {
+        return {{begin, end}};
+    }
+    auto lastBegin = std::max(last * ChunkMap::ChunkSize, end - ResumeVerifyBytesCnt);
+    return {{begin, begin + ResumeVerifyBytesCnt}, {lastBegin, end}};
+}
+
+void VideoDownloadTask::verifyResume()
+{
+    auto [begin, end] = verifyWindows.first();
+    auto request = Network::Bili::Request(mirrors[mirrorIndex]);
+    auto range = QByteArray::number(begin) + "-" + QByteArray::number(end - 1);
+    request.setRawHeader("Range", "bytes=" + range);
+
+    // throughputTimer only detects stall while verifying, see checkThroughput()
+    httpReply = Network::accessManager()->get(request);
+    connect(httpReply, &QNetworkReply::finished, this, [this, begin, end]{
+        auto reply = httpReply;
+        httpReply = nullptr;
+        reply->deleteLater();
+
+        auto stalled = std::exchange(isStalled, false);
+        auto error = reply->error();
+        if (error != QNetworkReply::NoError || !Network::isPartialContent(reply, begin, end)) {
+            if (error == QNetworkReply::OperationCanceledError && !stalled) {
+                closeFile();
+            } else if (!reconnect(reply)) {
+                closeFile();
+                emit errorOccurred("网络请求错误");
+            }
+            return;
+        }
+
+        auto remoteData = reply->readAll();
+        file->seek(begin);
+        auto localData = file->read(end - begin);
+        if (remoteData != localData) {
+            qDebug() << "resume verification failed, restart from scratch:" << path;
+            verifyWindows.clear();
+            if (!restartFromScratch()) {
+                closeFile();
+                emit errorOccurred("创建分块记录文件失败");
+                return;
+            }
+        } else {
+            verifyWindows.removeFirst();
+        }
 
-    auto request = Network::Bili::Request(url);
-    if (downloadedBytesCnt != 0) {
-        request.setRawHeader("Range", "bytes=" + QByteArray::number(downloadedBytesCnt) + "-");
+        if (verifyWindows.isEmpty()) {
+            noProgressTicks = 0;
+            startNextRange();
+        } else {
+            verifyResume();
+        }
+    });
+}
+
+bool VideoDownloadTask::restartFromScratch()
+{
+    file->resize(0);
+    if (!chunkMap->create(totalBytesCnt, qn, ChunkMap::fingerprint(mirrors.first(), fileMd5))) {
+        return false;
     }
+    pendingRanges = chunkMap->holes();
+    downloadedBytesCnt = 0;
+    return true;
+}
+
+void VideoDownloadTask::startNextRange()
+{
+    auto [begin, end] = pendingRanges.takeFirst();
+    rangeEnd = end;
+    nextChunkToMark = static_cast<int>(begin / ChunkMap::ChunkSize);
+    file->seek(begin);
+    requestStream();
+}
+
+void VideoDownloadTask::requestStream()
+{
+    // after switching mirror, the request begins from current position instead of range begin
+    streamBegin = file->pos();
+    isStreamAccepted = false;
+    auto request = Network::Bili::Request(mirrors[mirrorIndex]);
+    auto range = QByteArray::number(streamBegin) + "-" + QByteArray::number(rangeEnd - 1);
+    request.setRawHeader("Range", "bytes=" + range);
 
     httpReply = Network::accessManager()->get(request);
+    httpReply->setReadBufferSize(BufferedWriter::ReplyReadBufferSize);
     connect(httpReply, &QNetworkReply::readyRead, this, &VideoDownloadTask::onStreamReadyRead);
     connect(httpReply, &QNetworkReply::finished, this, &VideoDownloadTask::onStreamFinished);
+    connect(BandwidthShaper::inst(), &BandwidthShaper::refilled, httpReply, [this, reply = httpReply]{
+        if (reply == httpReply && reply->bytesAvailable() > 0) {
+            onStreamReadyRead();
+        }
+    });
+}
+
+bool VideoDownloadTask::acceptStreamReply(QNetworkReply *reply)
+{
+    if (Network::isPartialContent(reply, streamBegin, rangeEnd)) {
+        isStreamAccepted = true;
+        return true;
+    }
+    if (Network::statusCode(reply) < 300) {
+        // Range ignored (200 with whole file) or answered with another range
+        qDebug() << "unexpected range" << reply->rawHeader("Content-Range") << "from" << reply->url().host();
+        isRangeMismatched = true;
+        reply->abort();
+    } else {
+        // error page (e.g. 403 of an expired url) is discarded. see reconnect()
+        reply->skip(reply->bytesAvailable());
+    }
+    return false;
+}
+
+bool VideoDownloadTask::markCompletedChunks()
+{
+    // never beyond the range requested
+    auto pos = std::min(file->pos(), rangeEnd);
+    auto fileFlushed = false;
+    while (nextChunkToMark < chunkMap->chunkCount() && chunkMap->chunkEnd(nextChunkToMark) <= pos) {
+        // chunk data must reach the file before its bit in the chunk map
+        if (!fileFlushed) {
+            if (!file->flush()) {
+                return false;
+            }
+            fileFlushed = true;
+        }
+        if (!chunkMap->markCompleted(nextChunkToMark)) {
+            return false;
+        }
+        nextChunkToMark++;
+    }
+    return true;
 }
 
 void VideoDownloadTask::onStreamFinished()
@@ -336,33 +706,271 @@ void VideoDownloadTask::onStreamFinished()
     auto reply = httpReply;
     httpReply->deleteLater();
     httpReply = nullptr;
+    BandwidthShaper::inst()->pause(shaperClient); // the next stream (if any) acquires again
+
+    // data left in reply buffer is read regardless of bandwidth limit
+    if (reply->error() == QNetworkReply::NoError && reply->bytesAvailable() > 0
+            && (isStreamAccepted || acceptStreamReply(reply))) {
+        auto data = reply->readAll();
+        BandwidthShaper::inst()->consume(shaperClient, data.size());
+        if (!writeStreamData(data)) {
+            closeFile();
+            return;
+        }
+    }
 
-    file.reset();
+    // data buffered is written even if aborted, so that it is not downloaded again
+    auto flushed = writer.flush();
+    auto flushErrStr = writer.errorString();
+    if (!flushed) {
+        downloadedBytesCnt -= writer.pendingBytesCnt();
+        writer.discard();
+    } else if (!markCompletedChunks()) {
+        flushed = false;
+        flushErrStr = "无法更新分块记录";
+    }
 
-    if (reply->error() == QNetworkReply::OperationCanceledError) {
+    auto stalled = std::exchange(isStalled, false);
+    auto error = reply->error();
+    if (std::exchange(isRangeMismatched, false)) {
+        isSwitchingMirror = false;
+        if (flushed && mirrorIndex + 1 < mirrors.size()) {
+            mirrorIndex++;
+            qDebug() << "switch to mirror" << mirrors[mirrorIndex].host();
+            throughputWindow.clear();
+            requestStream();
+            return;
+        }
+        closeFile();
+        emit errorOccurred(flushed ? "服务器返回的数据范围有误" : "文件写入失败: " + flushErrStr);
+        return;
+    }
+    if (isSwitchingMirror) {
+        isSwitchingMirror = false;
+        if (flushed && error == QNetworkReply::OperationCanceledError) {
+            mirrorIndex++;
+            qDebug() << "switch to mirror" << mirrors[mirrorIndex].host();
+            throughputWindow.clear();
+            requestStream();
+            return;
+        }
+    }
+
+    auto isRangeCompleted = (file->pos() == rangeEnd);
+    if (flushed && error == QNetworkReply::NoError && isRangeCompleted && !pendingRanges.isEmpty()) {
+        startNextRange();
+        return;
+    }
+
+    if (flushed && (stalled || error != QNetworkReply::OperationCanceledError) && !isRangeCompleted) {
+        if (reconnect(reply)) {
+            return;
+        }
+    }
+
+    closeFile();
+
+    if (error == QNetworkReply::OperationCanceledError && !stalled) {
+        return;
+    }
+
+    if (!flushed) {
+        emit errorOccurred("文件写入失败: " + flushErrStr);
         return;
     }
 
-    if (reply->error() != QNetworkReply::NoError) {
+    if (stalled || error != QNetworkReply::NoError || !isRangeCompleted) {
         emit errorOccurred("网络请求错误");
         return;
     }
 
+    chunkMap->remove();
+    chunkMap.reset();
     emit downloadFinished();
 }
 
+void VideoDownloadTask::checkThroughput()
+{
+    auto throttled = BandwidthShaper::inst()->isThrottled(shaperClient);
+    if (downloadedBytesCnt > lastCheckedBytesCnt) {
+        consecutiveReconnectCnt = 0;
+    }
+    noProgressTicks = (downloadedBytesCnt == lastCheckedBytesCnt && !throttled ? noProgressTicks + 1 : 0);
+    lastCheckedBytesCnt = downloadedBytesCnt;
+    if (httpReply == nullptr || isSwitchingMirror || isStalled) {
+        return;
+    }
+    if (noProgressTicks * ThroughputTimerInterval >= StallTimeout) {
+        qDebug() << "connection stalled (no data):" << path;
+        stallCnt++;
+        isStalled = true;
+        httpReply->abort();
+        return;
+    }
+    if (!verifyWindows.isEmpty()) {
+        return; // verify reply in flight. mirror is not switched, see verifyResume()
+    }
+
+    throughputWindow.append(downloadedBytesCnt);
+    if (throughputWindow.size() <= MirrorCheckWindow) {
+        return;
+    }
+    throughputWindow.removeFirst();
+
+    auto bytesPerSec = (throughputWindow.last() - throughputWindow.first()) / (MirrorCheckWindow - 1);
+    auto remainingBytes = totalBytesCnt - downloadedBytesCnt;
+    if (bytesPerSec >= MirrorSwitchBytesPerSec || remainingBytes < MirrorSwitchBytesPerSec * MirrorCheckWindow) {
+        return;
+    }
+    if (throttled) {
+        return; // slow because of bandwidth limit
+    }
+
+    if (mirrorIndex + 1 < mirrors.size()) {
+        // resume from downloadedBytesCnt with next mirror. see onStreamFinished()
+        isSwitchingMirror = true;
+        httpReply->abort();
+    } else if (bytesPerSec < StallBytesPerSec) {
+        qDebug() << "connection stalled (" << bytesPerSec << "B/s):" << path;
+        stallCnt++;
+        isStalled = true;
+        httpReply->abort();
+    }
+}
+
+bool VideoDownloadTask::reconnect(QNetworkReply *failedReply)
+{
+    auto statusCode = Network::statusCode(failedReply);
+    auto isRetriable = (statusCode == 0 || statusCode == 403 || statusCode == 404 || statusCode >= 500);
+    if (!isRetriable || consecutiveReconnectCnt >= MaxConsecutiveReconnectCount) {
+        return false;
+    }
+
+    // url from cache may have expired. request a new one immediately
+    auto delay = std::min(ReconnectBaseDelay << consecutiveReconnectCnt, MaxReconnectDelay);
+    if ((statusCode == 403 || statusCode == 404) && isPlayUrlInfoCached) {
+        PlayUrlCache::inst()->remove(playUrlInfoCacheKey);
+        isPlayUrlInfoCached = false;
+        delay = 0;
+    }
+    consecutiveReconnectCnt++;
+    reconnectCnt++;
+    qDebug() << "reconnect in" << delay << "ms:" << path;
+
+    throughputTimer->stop();
+    if (reconnectTimer == nullptr) {
+        reconnectTimer = new QTimer(this);
+        reconnectTimer->setSingleShot(true);
+        connect(reconnectTimer, &QTimer::timeout, this, &VideoDownloadTask::refreshPlayUrl);
+    }
+    reconnectTimer->start(delay);
+    return true;
+}
+
+void VideoDownloadTask::refreshPlayUrl()
+{
+    PlayUrlCache::inst()->remove(playUrlInfoCacheKey);
+    httpReply = getPlayUrlInfo();
+    connect(httpReply, &QNetworkReply::finished, this, [this]{
+        auto reply = httpReply;
+        httpReply = nullptr;
+        reply->deleteLater();
+
+        if (reply->error() == QNetworkReply::OperationCanceledError) {
+            closeFile();
+            return;
+        }
+        auto dataKey = getPlayUrlInfoDataKey();
+        const auto [json, errorString] = Network::Bili::parseReply(reply, dataKey);
+        if (!errorString.isNull()) {
+            if (!reconnect(reply)) {
+                closeFile();
+                emit errorOccurred(errorString);
+            }
+            return;
+        }
+
+        auto data = json[dataKey].toObject();
+        auto durl = data["durl"].toArray();
+        auto durlObj = durl.isEmpty() ? QJsonObject() : durl.first().toObject();
+        if (durl.size() != 1 || durlObj["size"].toInteger() != totalBytesCnt) {
+            closeFile();
+            emit errorOccurred("获取到文件大小与先前不一致");
+            return;
+        }
+        if (getQnInfoFromPlayUrlInfo(data).currentQn != qn) {
+            closeFile();
+            emit errorOccurred("获取到画质与已下载部分不同. 请确定登录/会员状态");
+            return;
+        }
+        PlayUrlCache::inst()->insert(playUrlInfoCacheKey, data);
+        isPlayUrlInfoCached = false;
+
+        // the same size does not mean the same file
+        auto oldFingerprint = ChunkMap::fingerprint(mirrors.first(), fileMd5);
+        mirrors = mirrorsOfDurl(durlObj);
+        fileMd5 = durlObj["md5"].toString();
+        mirrorIndex = 0;
+        throughputWindow.clear();
+        noProgressTicks = 0;
+        throughputTimer->start();
+        if (ChunkMap::fingerprint(mirrors.first(), fileMd5) != oldFingerprint) {
+            qDebug() << "file on CDN changed, restart from scratch:" << path;
+            verifyWindows.clear();
+            if (!restartFromScratch()) {
+                closeFile();
+                emit errorOccurred("创建分块记录文件失败");
+                return;
+            }
+            startNextRange();
+            return;
+        }
+
+        // continue from current position of file
+        if (!verifyWindows.isEmpty()) {
+            verifyResume();
+        } else {
+            requestStream();
+        }
+    });
+}
+
 void VideoDownloadTask::onStreamReadyRead()
 {
-    auto tmp = downloadedBytesCnt + httpReply->bytesAvailable();
-    Q_ASSERT(file != nullptr);
-    if (-1 == file->write(httpReply->readAll())) {
-        emit errorOccurred("文件写入失败: " + file->errorString());
+    if (!isStreamAccepted && !acceptStreamReply(httpReply)) {
+        return;
+    }
+    auto size = BandwidthShaper::inst()->acquire(shaperClient, httpReply->bytesAvailable());
+    if (size == 0) {
+        return; // continue when BandwidthShaper::refilled() is emitted
+    }
+    if (!writeStreamData(httpReply->read(size))) {
         httpReply->abort();
-    } else {
-        downloadedBytesCnt = tmp;
     }
 }
 
+bool VideoDownloadTask::writeStreamData(const QByteArray &data)
+{
+    Q_ASSERT(file != nullptr);
+    // bytes beyond the range requested are dropped
+    auto size = std::min<qint64>(data.size(), rangeEnd - file->pos() - writer.pendingBytesCnt());
+    if (size <= 0) {
+        return true;
+    }
+    downloadedBytesCnt += size;
+    if (!writer.write(size < data.size() ? data.left(size) : data)) {
+        emit errorOccurred("文件写入失败: " + writer.errorString());
+        downloadedBytesCnt -= writer.pendingBytesCnt();
+        writer.discard();
+        return false;
+    }
+    if (!markCompletedChunks()) {
+        emit errorOccurred("文件写入失败: 无法更新分块记录");
+        return false;
+    }
+    return true;
+}
+
 
 
 QJsonObject PgcDownloadTask::toJsonObj() const
@@ -381,11 +989,16 @@ PgcDownloadTask::PgcDownloadTask(const QJsonObject &json)
 {
 }
 
-QNetworkReply *PgcDownloadTask::getPlayUrlInfo(qint64 epId, int qn)
+QString PgcDownloadTask::playUrlInfoUrl(qint64 epId, int qn)
 {
     auto api = "https://api.bilibili.com/pgc/player/web/playurl";
     auto query = QString("?ep_id=%1&qn=%2&fourk=1").arg(epId).arg(qn);
-    return Network::Bili::get(api + query);
+    return api + query;
+}
+
+QNetworkReply *PgcDownloadTask::getPlayUrlInfo(qint64 epId, int qn)
+{
+    return Network::Bili::get(playUrlInfoUrl(epId, qn));
 }
 
 QNetworkReply *PgcDownloadTask::getPlayUrlInfo() const
@@ -393,6 +1006,11 @@ QNetworkReply *PgcDownloadTask::getPlayUrlInfo() const
     return getPlayUrlInfo(epId, qn);
 }
 
+QString PgcDownloadTask::getPlayUrlInfoUrl() const
+{
+    return playUrlInfoUrl(epId, qn);
+}
+
 const QString PgcDownloadTask::playUrlInfoDataKey = "result";
 
 QString PgcDownloadTask::getPlayUrlInfoDataKey() const
@@ -400,6 +1018,11 @@ QString PgcDownloadTask::getPlayUrlInfoDataKey() const
     return playUrlInfoDataKey;
 }
 
+QString PgcDownloadTask::getPlayUrlInfoCacheKey() const
+{
+    return QStringLiteral("pgc/%1/%2").arg(epId).arg(qn);
+}
+
 
 
 QJsonObject PugvDownloadTask::toJsonObj() const
@@ -418,11 +1041,16 @@ PugvDownloadTask::PugvDownloadTask(const QJsonObject &json)
 {
 }
 
-QNetworkReply *PugvDownloadTask::getPlayUrlInfo(qint64 epId, int qn)
+QString PugvDownloadTask::playUrlInfoUrl(qint64 epId, int qn)
 {
     auto api = "https://api.bilibili.com/pugv/player/web/playurl";
     auto query = QString("?ep_id=%1&qn=%2&fourk=1").arg(epId).arg(qn);
-    return Network::Bili::get(api + query);
+    return api + query;
+}
+
+QNetworkReply *PugvDownloadTask::getPlayUrlInfo(qint64 epId, int qn)
+{
+    return Network::Bili::get(playUrlInfoUrl(epId, qn));
 }
 
 QNetworkReply *PugvDownloadTask::getPlayUrlInfo() const
@@ -430,6 +1058,11 @@ QNetworkReply *PugvDownloadTask::getPlayUrlInfo() const
     return getPlayUrlInfo(epId, qn);
 }
 
+QString PugvDownloadTask::getPlayUrlInfoUrl() const
+{
+    return playUrlInfoUrl(epId, qn);
+}
+
 const QString PugvDownloadTask::playUrlInfoDataKey = "data";
 
 QString PugvDownloadTask::getPlayUrlInfoDataKey() const
@@ -437,6 +1070,11 @@ QString PugvDownloadTask::getPlayUrlInfoDataKey() const
     return playUrlInfoDataKey;
 }
 
+QString PugvDownloadTask::getPlayUrlInfoCacheKey() const
+{
+    return QStringLiteral("pugv/%1/%2").arg(epId).arg(qn);
+}
+
 
 
 QJsonObject UgcDownloadTask::toJsonObj() const
@@ -455,11 +1093,16 @@ UgcDownloadTask::UgcDownloadTask(const QJsonObject &json)
 {
 }
 
-QNetworkReply *UgcDownloadTask::getPlayUrlInfo(qint64 aid, qint64 cid, int qn)
+QString UgcDownloadTask::playUrlInfoUrl(qint64 aid, qint64 cid, int qn)
 {
     auto api = "https://api.bilibili.com/x/player/playurl";
     auto query = QString("?avid=%1&cid=%2&qn=%3&fourk=1").arg(aid).arg(cid).arg(qn);
-    return Network::Bili::get(api + query);
+    return api + query;
+}
+
+QNetworkReply *UgcDownloadTask::getPlayUrlInfo(qint64 aid, qint64 cid, int qn)
+{
+    return Network::Bili::get(playUrlInfoUrl(aid, cid, qn));
 }
 
 QNetworkReply *UgcDownloadTask::getPlayUrlInfo() const
@@ -467,6 +1110,11 @@ QNetworkReply *UgcDownloadTask::getPlayUrlInfo() const
     return getPlayUrlInfo(aid, cid, qn);
 }
 
+QString UgcDownloadTask::getPlayUrlInfoUrl() const
+{
+    return playUrlInfoUrl(aid, cid, qn);
+}
+
 const QString UgcDownloadTask::playUrlInfoDataKey = "data";
 
 QString UgcDownloadTask::getPlayUrlInfoDataKey() const
@@ -474,13 +1122,23 @@ QString UgcDownloadTask::getPlayUrlInfoDataKey() const
     return playUrlInfoDataKey;
 }
 
+QString UgcDownloadTask::getPlayUrlInfoCacheKey() const
+{
+    return QStringLiteral("ugc/%1/%2/%3").arg(aid).arg(cid).arg(qn);
+}
 
 
-QNetworkReply *LiveDownloadTask::getPlayUrlInfo(qint64 roomId, int qn)
+
+QString LiveDownloadTask::playUrlInfoUrl(qint64 roomId, int qn)
 {
     auto api = "https://api.live.bilibili.com/xlive/web-room/v2/index/getRoomPlayInfo";
     auto query = QString("?protocol=0,1&format=0,1,2&codec=0,1&room_id=%1&qn=%2").arg(roomId).arg(qn);
-    return Network::Bili::get(api + query);
+    return api + query;
+}
+
+QNetworkReply *LiveDownloadTask::getPlayUrlInfo(qint64 roomId, int qn)
+{
+    return Network::Bili::get(playUrlInfoUrl(roomId, qn));
 }
 
 QNetworkReply *LiveDownloadTask::getPlayUrlInfo() const
@@ -488,6 +1146,11 @@ QNetworkReply *LiveDownloadTask::getPlayUrlInfo() const
     return getPlayUrlInfo(roomId, qn);
 }
 
+QString LiveDownloadTask::getPlayUrlInfoUrl() const
+{
+    return playUrlInfoUrl(roomId, qn);
+}
+
 const QString LiveDownloadTask::playUrlInfoDataKey = "data";
 
 QString LiveDownloadTask::getPlayUrlInfoDataKey() const
@@ -498,6 +1161,13 @@ QString LiveDownloadTask::getPlayUrlInfoDataKey() const
 LiveDownloadTask::LiveDownloadTask(qint64 roomId, int qn, const QString &path)
     : AbstractVideoDownloadTask(QString(), qn), basePath(path), roomId(roomId)
 {
+    shaperClient->priority = BandwidthShaper::Priority::Realtime;
+}
+
+void LiveDownloadTask::startDownload()
+{
+    consecutiveReconnectCnt = 0;
+    AbstractVideoDownloadTask::startDownload();
 }
 
 LiveDownloadTask::~LiveDownloadTask() = default;
@@ -594,72 +1264,180 @@ QString LiveDownloadTask::getPlayUrlFromPlayUrlInfo(const QJsonObject &data)
 
 void LiveDownloadTask::parsePlayUrlInfo(const QJsonObject &data)
 {
+    auto isResuming = (dldDelegate != nullptr);
     if (data["live_status"].toInt() != 1) {
-        emit errorOccurred("未开播或正在轮播");
+        dldDelegate.reset();
+        emit errorOccurred(isResuming ? "直播已结束" : "未开播或正在轮播");
         return;
     }
     qn = getQnInfoFromPlayUrlInfo(data).currentQn;
     auto url = getPlayUrlFromPlayUrlInfo(data);
     auto ext = Utils::fileExtension(QUrl(url).fileName());
     if (ext != ".flv") {
+        dldDelegate.reset();
         emit errorOccurred("非FLV");
         return;
     }
 
-    emit getUrlInfoFinished();
-
-    downloadedBytesCnt = 0;    
     httpReply = Network::Bili::get(url);
-    dldDelegate = std::make_unique<FlvLiveDownloadDelegate>(*httpReply, [this](){
-        auto dateStr = QDateTime::currentDateTime().toString("[yyyy.MM.dd] hh.mm.ss");
-        auto path = basePath + " " + dateStr + ".flv";
-        auto file = std::make_unique<QFile>(path);
-        if (file->open(QIODevice::WriteOnly)) {
-            this->path = std::move(path);
-            return file;
-        } else {
-            return decltype(file)();
+    if (isResuming) {
+        // continue in the same file, after the stream ended or the task was stopped
+        if (!isWaitingReconnect) {
+            emit getUrlInfoFinished();
         }
-    });
+        dldDelegate->resume(*httpReply);
+    } else {
+        emit getUrlInfoFinished();
+        downloadedBytesCnt = 0;
+        dldDelegate = std::make_unique<FlvLiveDownloadDelegate>(*httpReply, [this](){
+            auto dateStr = QDateTime::currentDateTime().toString("[yyyy.MM.dd] hh.mm.ss");
+            auto path = basePath + " " + dateStr + ".flv";
+            auto file = std::make_unique<QFile>(path);
+            if (file->open(QIODevice::WriteOnly)) {
+                this->path = std::move(path);
+                return file;
+            } else {
+                return decltype(file)();
+            }
+        });
+    }
 
     connect(httpReply, &QNetworkReply::readyRead, this, [this]() {
+        if (isWaitingReconnect) {
+            isWaitingReconnect = false;
+            consecutiveReconnectCnt = 0;
+            lastReconnectLatency = disconnectedTimer.elapsed();
+            qDebug() << "live stream reconnected in" << lastReconnectLatency << "ms:" << roomId;
+        }
         auto ret = dldDelegate->newDataArrived();
         if (!ret) {
+            auto errStr = dldDelegate->errorString();
             httpReply->abort();
-            emit errorOccurred(dldDelegate->errorString());
+            dldDelegate.reset();
+            emit errorOccurred(errStr);
+            return;
         }
+        auto prevBytesCnt = downloadedBytesCnt;
         downloadedBytesCnt = dldDelegate->getReadBytesCnt() + httpReply->bytesAvailable();
+        BandwidthShaper::inst()->consume(shaperClient, downloadedBytesCnt - prevBytesCnt);
     });
 
-    connect(httpReply, &QNetworkReply::finished, this, [this](){
+    connect(httpReply, &QNetworkReply::finished, this, &LiveDownloadTask::onStreamFinished);
+}
+
+void LiveDownloadTask::onStreamFinished()
+{
+    auto reply = httpReply;
+    httpReply = nullptr;
+    reply->deleteLater();
+
+    // dldDelegate (and the file) is kept, so that the task continues in the same file if started again
+    if (reply->error() == QNetworkReply::OperationCanceledError) {
+        return;
+    }
+
+    // the stream may end because of CDN switching or network problems. check live status and reconnect
+    if (!isWaitingReconnect) {
+        isWaitingReconnect = true;
+        disconnectedTimer.start();
+    }
+    if (!scheduleReconnect()) {
+        if (reply->error() != QNetworkReply::NoError) {
+            emit errorOccurred("网络请求错误");
+        } else {
+            emit errorOccurred("已结束或下载速度过慢");
+        }
+    }
+}
+
+bool LiveDownloadTask::scheduleReconnect()
+{
+    if (consecutiveReconnectCnt >= MaxLiveReconnectCount) {
+        isWaitingReconnect = false;
+        return false;
+    }
+    auto delay = (consecutiveReconnectCnt == 0 ? 0 : LiveReconnectBaseDelay << (consecutiveReconnectCnt - 1));
+    consecutiveReconnectCnt++;
+    reconnectCnt++;
+    if (reconnectTimer == nullptr) {
+        reconnectTimer = new QTimer(this);
+        reconnectTimer->setSingleShot(true);
+        connect(reconnectTimer, &QTimer::timeout, this, &LiveDownloadTask::reconnect);
+    }
+    reconnectTimer->start(delay);
+    return true;
+}
+
+void LiveDownloadTask::reconnect()
+{
+    httpReply = getPlayUrlInfo();
+    connect(httpReply, &QNetworkReply::finished, this, [this]{
         auto reply = httpReply;
         httpReply = nullptr;
         reply->deleteLater();
-        dldDelegate.reset();
 
         if (reply->error() == QNetworkReply::OperationCanceledError) {
+            isWaitingReconnect = false;
+            return;
+        }
+        // the API may fail as well while the network is down. retried with the same backoff
+        auto dataKey = getPlayUrlInfoDataKey();
+        const auto [json, errorString] = Network::Bili::parseReply(reply, dataKey);
+        if (!errorString.isNull()) {
+            if (!scheduleReconnect()) {
+                emit errorOccurred(errorString);
+            }
             return;
-        } else if (reply->error() != QNetworkReply::NoError) {
-            emit errorOccurred("网络请求错误");
-        } else {
-            emit errorOccurred("已结束或下载速度过慢");
         }
+        parsePlayUrlInfo(json[dataKey].toObject());
     });
 }
 
+void LiveDownloadTask::stopDownload()
+{
+    if (reconnectTimer != nullptr) {
+        reconnectTimer->stop();
+    }
+    isWaitingReconnect = false;
+    AbstractVideoDownloadTask::stopDownload();
+}
 
-ComicDownloadTask::~ComicDownloadTask() = default;
+qint64 LiveDownloadTask::getLastReconnectGap() const
+{
+    return (dldDelegate == nullptr ? -1 : dldDelegate->getLastGapInMSec());
+}
+
+ComicDownloadTask::ComicDownloadTask(qint64 comicId, qint64 epId, const QString &path)
+    : AbstractDownloadTask(path), comicId(comicId), epId(epId)
+{
+    isCbz = Settings::inst()->value("comic/cbz", false).toBool();
+    if (isCbz) {
+        this->path += ".cbz";
+    }
+}
+
+ComicDownloadTask::~ComicDownloadTask()
+{
+    abortImgFetches();
+}
 
 QJsonObject ComicDownloadTask::toJsonObj() const
 {
+    // images may finish out of order. size of each image is saved (-1 if not finished)
+    QJsonArray sizes;
+    for (auto size : imgSizes) {
+        sizes.append(size);
+    }
     return QJsonObject {
         {"type", static_cast<int>(ContentType::Comic)},
         {"path", path},
         {"id", comicId},
         {"epid", epId},
         {"imgs", finishedImgCnt},
-        {"bytes", bytesCntTillLastImg},
+        {"bytes", finishedBytesCnt},
         {"total", totalImgCnt},
+        {"sizes", sizes},
+        {"cbz", isCbz},
     };
 }
 
@@ -669,11 +1447,35 @@ ComicDownloadTask::ComicDownloadTask(const QJsonObject &json)
       epId(json["epid"].toInteger()),
       totalImgCnt(json["total"].toInt(0)),
       finishedImgCnt(json["imgs"].toInt(0)),
-      bytesCntTillLastImg(json["bytes"].toInteger(0))
-{
+      finishedBytesCnt(json["bytes"].toInteger(0)),
+      isCbz(json["cbz"].toBool(false))
+{
+    // tasks saved by older versions have no sizes. existing files are checked when started
+    auto sizes = json["sizes"].toArray();
+    if (sizes.size() == totalImgCnt) {
+        imgSizes.reserve(totalImgCnt);
+        for (auto &&size : sizes) {
+            imgSizes.append(size.toInteger(-1));
+        }
+    }
 }
 
 void ComicDownloadTask::startDownload()
+{
+    if (!ComicPipeline::isBatchMode()) {
+        requestImgIndex();
+        return;
+    }
+    auto pipeline = ComicPipeline::inst();
+    pipeline->queueIndexRequest(this, [this]{
+        requestImgIndex();
+        return httpReply;
+    });
+    connect(pipeline, &ComicPipeline::imgFetchSlotReleased, this, &ComicDownloadTask::onImgFetchSlotReleased,
+            static_cast<Qt::ConnectionType>(Qt::QueuedConnection | Qt::UniqueConnection));
+}
+
+void ComicDownloadTask::requestImgIndex()
 {
     auto getImgPathsUrl = "https://manga.bilibili.com/twirp/comic.v1.Comic/GetImageIndex?device=pc&platform=web";
 //    auto postData = "{\"ep_id\":" + QByteArray::number(epid) + "}";
@@ -684,15 +1486,38 @@ void ComicDownloadTask::startDownload()
 
 void ComicDownloadTask::stopDownload()
 {
+    ComicPipeline::inst()->cancelIndexRequest(this);
     if (httpReply != nullptr) {
         httpReply->abort();
     }
+    abortImgFetches();
+    cbz.reset(); // without central directory. resumed when started again
 }
 
 void ComicDownloadTask::removeFile()
 {
-    // simple but may delete innocent files !!!
-    QDir(path).removeRecursively();
+    if (isCbz) {
+        cbz.reset();
+        QFile::remove(path);
+        return;
+    }
+
+    // only images of this task are removed. the directory is removed if empty then
+    QDir dir(path);
+    for (auto &fileInfo : dir.entryInfoList(QDir::Files)) {
+        if (isOwnImgFile(fileInfo)) {
+            QFile::remove(fileInfo.filePath());
+        }
+    }
+    QDir().rmdir(path);
+}
+
+bool ComicDownloadTask::isOwnImgFile(const QFileInfo &fileInfo) const
+{
+    auto baseName = fileInfo.completeBaseName();
+    bool ok;
+    auto num = baseName.toInt(&ok);
+    return ok && num >= 1 && num <= totalImgCnt && baseName.size() == Utils::numberOfDigit(totalImgCnt);
 }
 
 void ComicDownloadTask::getImgInfoFinished()
@@ -702,50 +1527,223 @@ void ComicDownloadTask::getImgInfoFinished()
         return;
     }
 
-    // assert: imgRqstPaths.isEmpty()
-
     auto images = data["images"].toArray();
     totalImgCnt = images.size();
+    imgRqstPaths.clear();
     imgRqstPaths.reserve(totalImgCnt);
     for (auto &&imgObjRef : images) {
         auto imgObj = imgObjRef.toObject();
         imgRqstPaths.append(imgObj["path"].toString());
     }
+    if (imgSizes.size() != totalImgCnt) {
+        imgSizes.fill(-1, totalImgCnt);
+    }
+    nextTokenImgIdx = 0;
+    readyImgs.clear();
+    if (isCbz) {
+        if (!openCbz()) {
+            return;
+        }
+    } else {
+        checkExistingImgs();
+    }
     emit getUrlInfoFinished();
-    downloadNextImg();
+
+    if (finishedImgCnt >= totalImgCnt) {
+        finishDownload();
+        return;
+    }
+    requestImgTokens();
 }
 
-void ComicDownloadTask::downloadNextImg()
+bool ComicDownloadTask::openCbz()
 {
-    if (finishedImgCnt == totalImgCnt) {
-        emit downloadFinished();
+    if (!QDir().mkpath(QFileInfo(path).absolutePath())) {
+        emit errorOccurred("创建目录失败");
+        return false;
+    }
+    cbz.reset();
+    cbz = std::make_unique<CbzWriter>(path);
+    if (!cbz->open()) {
+        cbz.reset();
+        emit errorOccurred("打开文件失败");
+        return false;
+    }
+
+    // the archive is the only record of finished images
+    imgSizes.fill(-1, totalImgCnt);
+    finishedImgCnt = 0;
+    finishedBytesCnt = 0;
+    for (auto &entry : cbz->entries()) {
+        bool ok;
+        auto index = QFileInfo(QString::fromUtf8(entry.name)).completeBaseName().toInt(&ok) - 1;
+        if (ok && index >= 0 && index < totalImgCnt && imgSizes[index] < 0) {
+            imgSizes[index] = entry.size;
+            finishedImgCnt++;
+            finishedBytesCnt += entry.size;
+        }
+    }
+    return true;
+}
+
+// checks end marker of jpeg/png and size in header of webp. other formats are assumed complete
+static bool isImgFileComplete(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < 12) {
+        return false;
+    }
+    auto head = file.read(12);
+    file.seek(file.size() - 12);
+    auto tail = file.read(12);
+    if (head.startsWith("\xFF\xD8")) {
+        // some encoders append padding after EOI
+        return tail.contains("\xFF\xD9");
+    }
+    if (head.startsWith("\x89PNG")) {
+        return tail.mid(4, 4) == "IEND";
+    }
+    if (head.startsWith("RIFF") && head.mid(8, 4) == "WEBP") {
+        return qFromLittleEndian<quint32>(head.constData() + 4) + 8 == file.size();
+    }
+    return true;
+}
+
+void ComicDownloadTask::checkExistingImgs()
+{
+    // images finished but not saved (crashed), removed by user, or broken are all possible
+    QHash<int, QList<QFileInfo>> filesOfImg;
+    for (auto &fileInfo : QDir(path).entryInfoList(QDir::Files)) {
+        if (isOwnImgFile(fileInfo)) {
+            filesOfImg[fileInfo.completeBaseName().toInt() - 1].append(fileInfo);
+        }
+    }
+
+    finishedImgCnt = 0;
+    finishedBytesCnt = 0;
+    for (int i = 0; i < totalImgCnt; i++) {
+        qint64 size = -1;
+        for (auto &fileInfo : filesOfImg.value(i)) {
+            auto sizeMatched = (imgSizes[i] < 0 || fileInfo.size() == imgSizes[i]);
+            if (sizeMatched && isImgFileComplete(fileInfo.filePath())) {
+                size = fileInfo.size();
+                break;
+            }
+        }
+        imgSizes[i] = size;
+        if (size >= 0) {
+            finishedImgCnt++;
+            finishedBytesCnt += size;
+        }
+    }
+}
+
+void ComicDownloadTask::finishDownload()
+{
+    BandwidthShaper::inst()->pause(shaperClient);
+    if (cbz) {
+        auto committed = cbz->finish();
+        cbz.reset();
+        if (!committed) {
+            emit errorOccurred("保存文件失败");
+            return;
+        }
+    }
+    emit downloadFinished();
+}
+
+void ComicDownloadTask::requestImgTokens()
+{
+    QJsonArray urls;
+    QList<int> indexes;
+    for (; nextTokenImgIdx < totalImgCnt && indexes.size() < ImgTokenBatchSize; nextTokenImgIdx++) {
+        if (imgSizes[nextTokenImgIdx] < 0) {
+            urls.append(imgRqstPaths[nextTokenImgIdx]);
+            indexes.append(nextTokenImgIdx);
+        }
+    }
+    if (indexes.isEmpty()) {
         return;
     }
+
+    // "urls" is a string of json array
     auto getTokenUrl = "https://manga.bilibili.com/twirp/comic.v1.Comic/ImageToken?device=pc&platform=web";
-    auto postData = R"({"urls":"[\")" + imgRqstPaths[finishedImgCnt].toUtf8() + R"(\"]"})";
-    httpReply = Network::Bili::postJson(getTokenUrl, postData);
+    auto urlsStr = QString::fromUtf8(QJsonDocument(urls).toJson(QJsonDocument::Compact));
+    httpReply = Network::Bili::postJson(getTokenUrl, {{"urls", urlsStr}});
+    connect(httpReply, &QNetworkReply::finished, this, [this, indexes]{
+        auto data = getReplyJson("data");
+        if (data.isNull() || data.isUndefined()) {
+            abortImgFetches();
+            return;
+        }
+        auto tokens = data.toArray();
+        if (tokens.size() != indexes.size()) {
+            abortImgFetches();
+            emit errorOccurred("获取图片 token 失败");
+            return;
+        }
+        for (int i = 0; i < indexes.size(); i++) {
+            auto obj = tokens[i].toObject();
+            readyImgs.append({indexes[i], obj["url"].toString() + "?token=" + obj["token"].toString()});
+        }
+        startImgFetches();
+    });
+}
 
-    connect(httpReply, &QNetworkReply::finished, this, &ComicDownloadTask::getImgTokenFinished);
+void ComicDownloadTask::startImgFetches()
+{
+    while (canStartImgFetch() && !readyImgs.isEmpty()) {
+        auto [index, url] = readyImgs.takeFirst();
+        auto fileName = Utils::paddedNum(index + 1, Utils::numberOfDigit(totalImgCnt))
+                        + Utils::fileExtension(QUrl(url).fileName());
+        auto fetch = std::make_unique<ImgFetch>();
+        fetch->index = index;
+        fetch->fileName = fileName;
+        if (!isCbz) {
+            fetch->file = openFileForWrite(fileName);
+            if (!fetch->file) {
+                abortImgFetches();
+                return;
+            }
+            fetch->writer.setDevice(fetch->file.get());
+        }
+        auto reply = Network::Bili::get(url);
+        fetch->reply = reply;
+        reply->setReadBufferSize(BufferedWriter::ReplyReadBufferSize);
+        if (ComicPipeline::isBatchMode()) {
+            ComicPipeline::inst()->addImgFetch(reply);
+        }
+        auto fetchPtr = fetch.get();
+        connect(BandwidthShaper::inst(), &BandwidthShaper::refilled, reply, [this, fetchPtr]{
+            if (fetchPtr->reply->bytesAvailable() > 0) {
+                onImgReadyRead(fetchPtr);
+            }
+        });
+        connect(reply, &QNetworkReply::readyRead, this, [this, fetchPtr]{ onImgReadyRead(fetchPtr); });
+        connect(reply, &QNetworkReply::finished, this, [this, fetchPtr]{ onImgFetchFinished(fetchPtr); });
+        imgFetches.push_back(std::move(fetch));
+    }
+
+    // keep tokens of next images ready
+    if (httpReply == nullptr && readyImgs.size() < MaxImgFetchesInFlight) {
+        requestImgTokens();
+    }
 }
 
-void ComicDownloadTask::getImgTokenFinished()
+bool ComicDownloadTask::canStartImgFetch() const
 {
-    auto data = getReplyJson("data");
-    if (data.isNull() || data.isUndefined()) {
-        return;
+    if (ComicPipeline::isBatchMode()) {
+        return ComicPipeline::inst()->hasFreeImgFetchSlot();
     }
-    auto obj = data.toArray().first();
-    auto token = obj["token"].toString();
-    auto url = obj["url"].toString();
-    auto index = Utils::paddedNum(finishedImgCnt + 1, Utils::numberOfDigit(totalImgCnt));
-    auto fileName = index + Utils::fileExtension(url);
-    file = openFileForWrite(fileName);
-    if (!file) {
-        return;
+    return imgFetches.size() < MaxImgFetchesInFlight;
+}
+
+void ComicDownloadTask::onImgFetchSlotReleased()
+{
+    // images are ready only while downloading
+    if (!readyImgs.isEmpty()) {
+        startImgFetches();
     }
-    httpReply = Network::Bili::get(url + "?token=" + token);
-    connect(httpReply, &QNetworkReply::readyRead, this, &ComicDownloadTask::onImgReadyRead);
-    connect(httpReply, &QNetworkReply::finished, this, &ComicDownloadTask::downloadImgFinished);
 }
 
 std::unique_ptr<QSaveFile> ComicDownloadTask::openFileForWrite(const QString &fileName)
@@ -766,82 +1764,119 @@ std::unique_ptr<QSaveFile> ComicDownloadTask::openFileForWrite(const QString &fi
     return f;
 }
 
-void ComicDownloadTask::onImgReadyRead()
+void ComicDownloadTask::onImgReadyRead(ImgFetch *fetch)
 {
-    if (curImgTotalBytesCnt == 0) {
-        curImgRecvBytesCnt = httpReply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    auto size = BandwidthShaper::inst()->acquire(shaperClient, fetch->reply->bytesAvailable());
+    if (size == 0) {
+        return; // continue when BandwidthShaper::refilled() is emitted
     }
-    auto size = httpReply->bytesAvailable();
-    if (-1 == file->write(httpReply->readAll())) {
-        emit errorOccurred("文件写入失败: " + file->errorString());
-        abortCurrentImg();
-        httpReply->abort();
-    } else {
-        curImgRecvBytesCnt += size;
+    auto data = fetch->reply->read(size);
+    if (fetch->file == nullptr) {
+        fetch->data.append(data);
+    } else if (!fetch->writer.write(data)) {
+        auto errStr = fetch->writer.errorString();
+        abortImgFetches();
+        emit errorOccurred("文件写入失败: " + errStr);
+        return;
     }
+    fetch->recvBytesCnt += data.size();
 }
 
-void ComicDownloadTask::abortCurrentImg()
+static void releaseImgReply(QNetworkReply *reply, QObject *receiver)
 {
-    curImgRecvBytesCnt = 0;
-    curImgTotalBytesCnt = 0;
-    file.reset();
+    reply->disconnect(receiver);
+    BandwidthShaper::inst()->disconnect(reply);
+    reply->deleteLater();
 }
 
-void ComicDownloadTask::downloadImgFinished()
+void ComicDownloadTask::abortImgFetches()
 {
-    auto imgSize = curImgRecvBytesCnt;
-    curImgRecvBytesCnt = 0;
-    curImgTotalBytesCnt = 0;
-
-    auto httpReply = this->httpReply;
-    this->httpReply->deleteLater();
-    this->httpReply = nullptr;
-
-    auto file = std::move(this->file);
+    // files not committed are discarded
+    auto fetches = std::move(imgFetches);
+    imgFetches.clear();
+    for (auto &fetch : fetches) {
+        releaseImgReply(fetch->reply, this);
+        fetch->reply->abort();
+    }
+    readyImgs.clear();
+    if (httpReply != nullptr) {
+        httpReply->abort();
+    }
+    BandwidthShaper::inst()->pause(shaperClient);
+}
+
+void ComicDownloadTask::onImgFetchFinished(ImgFetch *fetch)
+{
+    auto it = std::find_if(imgFetches.begin(), imgFetches.end(), [fetch](auto &ptr){ return ptr.get() == fetch; });
+    auto fetchHolder = std::move(*it);
+    imgFetches.erase(it);
+    auto reply = fetch->reply;
+    releaseImgReply(reply, this);
+
+    auto error = reply->error();
+    auto flushed = false;
+    if (error == QNetworkReply::NoError) {
+        // data left in reply buffer is read regardless of bandwidth limit
+        auto data = reply->readAll();
+        BandwidthShaper::inst()->consume(shaperClient, data.size());
+        fetch->recvBytesCnt += data.size();
+        if (fetch->file == nullptr) {
+            fetch->data.append(data);
+            flushed = true;
+        } else {
+            flushed = fetch->writer.write(data) && fetch->writer.flush();
+        }
+    }
+    fetch->writer.setDevice(nullptr);
 
-    auto error = httpReply->error();
     if (error != QNetworkReply::NoError) {
         if (error != QNetworkReply::OperationCanceledError) {
+            abortImgFetches();
             emit errorOccurred("网络错误");
         }
         return;
     }
 
-    if (!file->commit()) {
+    auto saved = flushed && (fetch->file == nullptr ? cbz->addEntry(fetch->fileName, fetch->data)
+                                                    : fetch->file->commit());
+    if (!saved) {
+        abortImgFetches();
         emit errorOccurred("保存文件失败");
         return;
     }
 
+    imgSizes[fetch->index] = fetch->recvBytesCnt;
     finishedImgCnt++;
-    bytesCntTillLastImg += imgSize;
-    downloadNextImg();
+    finishedBytesCnt += fetch->recvBytesCnt;
+    if (finishedImgCnt == totalImgCnt) {
+        finishDownload();
+        return;
+    }
+    startImgFetches();
+}
+
+qint64 ComicDownloadTask::inFlightBytesCnt() const
+{
+    qint64 ret = 0;
+    for (auto &fetch : imgFetches) {
+        ret += fetch->recvBytesCnt;
+    }
+    return ret;
 }
 
 qint64 ComicDownloadTask::getDownloadedBytesCnt() const
 {
-    return bytesCntTillLastImg + curImgRecvBytesCnt;
+    return finishedBytesCnt + inFlightBytesCnt();
 }
 
 int ComicDownloadTask::estimateRemainingSeconds(qint64 downBytesPerSec) const
 {
-    if (downBytesPerSec == 0) {
+    if (downBytesPerSec == 0 || finishedImgCnt == 0) {
         return Unknown;
     }
-
-    if (finishedImgCnt == totalImgCnt - 1 && curImgTotalBytesCnt != 0) {
-        // last image, remaining bytes count is known
-        return (curImgTotalBytesCnt - curImgRecvBytesCnt) / downBytesPerSec;
-    } else if (finishedImgCnt == 0) {
-        if (curImgTotalBytesCnt == 0) {
-            return Unknown;
-        } else {
-            return (curImgTotalBytesCnt * totalImgCnt - curImgRecvBytesCnt) / downBytesPerSec;
-        }
-    } else {
-        int estimateTotalBytes = bytesCntTillLastImg * totalImgCnt / finishedImgCnt;
-        return (estimateTotalBytes - bytesCntTillLastImg - curImgRecvBytesCnt) / downBytesPerSec;
-    }
+    auto estimateTotalBytes = finishedBytesCnt * totalImgCnt / finishedImgCnt;
+    auto remainingBytes = std::max<qint64>(estimateTotalBytes - finishedBytesCnt - inFlightBytesCnt(), 0);
+    return static_cast<int>(remainingBytes / downBytesPerSec);
 }
 
 double ComicDownloadTask::getProgress() const
@@ -852,12 +1887,6 @@ double ComicDownloadTask::getProgress() const
     }
 
     return static_cast<double>(finishedImgCnt) / totalImgCnt;
-//    double progress = static_cast<double>(finishedImgCnt * 100) / static_cast<double>(totalImgCnt);
-//    if (curImgTotalBytesCnt != 0) {
-//        int estimateTotalBytes = totalImgCnt * curImgTotalBytesCnt;
-//        progress += static_cast<double>(curImgRecvBytesCnt * 100) / static_cast<double>(estimateTotalBytes);
-//    }
-//    return static_cast<int>(progress);
 }
 
 QString ComicDownloadTask::getProgressStr() const
@@ -869,6 +1898,15 @@ QString ComicDownloadTask::getProgressStr() const
     }
 }
 
+qint64 ComicDownloadTask::getBufferedBytesCnt() const
+{
+    qint64 ret = 0;
+    for (auto &fetch : imgFetches) {
+        ret += fetch->writer.pendingBytesCnt() + fetch->data.size();
+    }
+    return ret;
+}
+
 QString ComicDownloadTask::getQnDescription() const
 {
     return QString();
@@ -5,10 +5,21 @@
 #include <memory>
 #include <QFile>
 #include <QSaveFile>
+#include <QUrl>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QMutex>
+#include <atomic>
+#include "BufferedWriter.h"
+#include "BandwidthShaper.h"
 //#include <utility>
 
 class QNetworkReply;
 class QFile;
+class QTimer;
+class QFileInfo;
+class MirrorProber;
+class ChunkMap;
 
 using QnList = QList<int>;
 
@@ -33,6 +44,12 @@ public:
     virtual void startDownload() = 0;
     virtual void stopDownload() = 0;
 
+    /**
+     * @brief startDownload() tagged with runId, which is carried by the run...() signals
+     * so that the receiver can ignore signals queued by an earlier run
+     */
+    void startRun(int runId);
+
     /**
      * @brief download task should be stopped when this method is called.
      */
@@ -43,14 +60,20 @@ signals:
     void errorOccurred(const QString &errorString);
     void getUrlInfoFinished();
 
+    // the signals above, re-emitted with runId of startRun()
+    void runFinished(int runId);
+    void runErrorOccurred(int runId, const QString &errorString);
+    void runGetUrlInfoFinished(int runId);
+
 protected:
     QString path;
     QNetworkReply *httpReply = nullptr;
+    BandwidthShaper::Client *shaperClient;
     QJsonValue getReplyJson(const QString &dataKey = QString());
 
     // AbstractDownloadTask() = default;
 
-    AbstractDownloadTask(const QString &path): path(path) {}
+    AbstractDownloadTask(const QString &path);
 
 public:
     virtual ~AbstractDownloadTask();
@@ -63,6 +86,29 @@ public:
      */
     virtual qint64 getDownloadedBytesCnt() const = 0;
 
+    /**
+     * @return bytes received but not yet written to file
+     */
+    virtual qint64 getBufferedBytesCnt() const { return 0; }
+
+    /**
+     * @brief number of stalled connections detected and automatic reconnects
+     */
+    virtual int getStallCnt() const { return 0; }
+    virtual int getReconnectCnt() const { return 0; }
+
+    /**
+     * @return true if waiting to reconnect after a connection failed
+     */
+    virtual bool isReconnecting() const { return false; }
+
+    /**
+     * @return time (ms) from the last disconnect until data arrived again,
+     * and media time (ms) lost in between. -1 if unknown
+     */
+    virtual qint64 getLastReconnectLatency() const { return -1; }
+    virtual qint64 getLastReconnectGap() const { return -1; }
+
     /**
      * @return estimate remaining time (in seconds) using downBytesPerSec.
      * -1 for INF or unknown. LiveDownloadTask returns time since download started.
@@ -80,6 +126,58 @@ public:
      * @return quality description if exists, else null QString
      */
     virtual QString getQnDescription() const = 0;
+
+    /**
+     * @brief state shown by UI. a task may live in a download thread (see DownloadEngine),
+     * in which case UI reads snapshots instead of calling the getters above
+     */
+    struct Snapshot
+    {
+        QString path;
+        QString title;
+        QString qnDescription;
+        QString progressStr;
+        double progress = 0;
+        qint64 downloadedBytesCnt = 0;
+        qint64 bufferedBytesCnt = 0;
+        int remainingSeconds = -1; // estimated with rate set by setDownRate()
+        int stallCnt = 0;
+        int reconnectCnt = 0;
+        bool reconnecting = false;
+        qint64 lastReconnectLatency = -1;
+        qint64 lastReconnectGap = -1;
+        QJsonObject json;
+
+        // playurl request of video tasks, prefetched for waiting tasks (see PlayUrlResolver).
+        // cache key is empty if playurl info is not cached
+        QString playUrlCacheKey;
+        QString playUrlInfoUrl;
+        QString playUrlInfoDataKey;
+    };
+
+    /**
+     * @return current state if called in the thread of the task, else the last refreshed one
+     */
+    Snapshot getSnapshot() const;
+
+    /**
+     * @brief should be called in the thread of the task
+     */
+    void refreshSnapshot();
+
+    /**
+     * @brief set download rate measured by UI, which is used to estimate remaining time. thread-safe
+     */
+    void setDownRate(qint64 bytesPerSec) { downRate.store(bytesPerSec, std::memory_order_relaxed); }
+
+protected:
+    virtual Snapshot takeSnapshot() const;
+
+private:
+    int runId = 0;
+    mutable QMutex snapshotMutex;
+    Snapshot snapshot;
+    std::atomic<qint64> downRate {0};
 };
 
 
@@ -105,11 +203,28 @@ public:
     void stopDownload() override;
 
     virtual QNetworkReply *getPlayUrlInfo() const = 0;
+    virtual QString getPlayUrlInfoUrl() const = 0;
     virtual QString getPlayUrlInfoDataKey() const = 0;
 
+    /**
+     * @return key of playurl info of the content, or empty string if it should not be cached
+     */
+    virtual QString getPlayUrlInfoCacheKey() const { return QString(); }
+
+    /**
+     * @return key of playurl info in PlayUrlCache: getPlayUrlInfoCacheKey() and the logged-in user
+     */
+    QString playUrlCacheKey() const;
+
 protected:
+    QString playUrlInfoCacheKey;
+    bool isPlayUrlInfoCached = false;
+
+    Snapshot takeSnapshot() const override;
+    quint32 cacheHitId = 0; // parsing of cached playurl info is cancelled if changed
+
     /**
-     * @brief parse json returned from getPlayUrlInfo request.
+     * @brief parse json returned from getPlayUrlInfo request (or from PlayUrlCache).
      * start download if success, otherwise emit signal errorOccurred()
      */
     virtual void parsePlayUrlInfo(const QJsonObject &data) = 0;
@@ -125,6 +240,14 @@ class LiveDownloadTask : public AbstractVideoDownloadTask
 
     std::unique_ptr<FlvLiveDownloadDelegate> dldDelegate;
 
+    // reconnect after stream ends. see onStreamFinished(). dldDelegate is kept until live ends or an error occurs
+    QTimer *reconnectTimer = nullptr;
+    bool isWaitingReconnect = false;
+    QElapsedTimer disconnectedTimer;
+    int reconnectCnt = 0;
+    int consecutiveReconnectCnt = 0;
+    qint64 lastReconnectLatency = -1;
+
 public:
     const qint64 roomId;
 
@@ -134,24 +257,43 @@ public:
 
     QJsonObject toJsonObj() const override;
 
+    void startDownload() override;
+    void stopDownload() override;
+
     QString getTitle() const override;
     void removeFile() override;
     int estimateRemainingSeconds(qint64 downBytesPerSec) const override;
     double getProgress() const override { return -1; }
     QString getProgressStr() const override;
     QString getQnDescription() const override;
+    int getReconnectCnt() const override { return reconnectCnt; }
+    bool isReconnecting() const override { return isWaitingReconnect; }
+    qint64 getLastReconnectLatency() const override { return lastReconnectLatency; }
+    qint64 getLastReconnectGap() const override;
 
     static QnList getAllPossibleQn();
     static QString getQnDescription(int qn);
     static QnInfo getQnInfoFromPlayUrlInfo(const QJsonObject &);
     static QString getPlayUrlFromPlayUrlInfo(const QJsonObject &);
+    static QString playUrlInfoUrl(qint64 roomId, int qn);
     static QNetworkReply *getPlayUrlInfo(qint64 roomId, int qn);
     QNetworkReply *getPlayUrlInfo() const override;
+    QString getPlayUrlInfoUrl() const override;
     static const QString playUrlInfoDataKey;
     QString getPlayUrlInfoDataKey() const override;
 
 protected:
+    /**
+     * @brief start recording, or feed the new stream to dldDelegate if reconnecting
+     */
     void parsePlayUrlInfo(const QJsonObject &data) override;
+    void onStreamFinished();
+
+    /**
+     * @return false if too many reconnects failed
+     */
+    bool scheduleReconnect();
+    void reconnect();
 };
 
 class VideoDownloadTask : public AbstractVideoDownloadTask
@@ -160,16 +302,51 @@ class VideoDownloadTask : public AbstractVideoDownloadTask
 
     qint64 totalBytesCnt = 0;
 
+    QList<QUrl> mirrors; // urls of the same file. ranked by MirrorProber if more than one
+    int mirrorIndex = 0;
+    bool isSwitchingMirror = false;
+    std::unique_ptr<MirrorProber> mirrorProber;
+    QTimer *throughputTimer = nullptr;
+    QList<qint64> throughputWindow;
+
+    bool hasChunkMap = false; // false for tasks saved by earlier versions
+    std::unique_ptr<ChunkMap> chunkMap;
+    QList<std::pair<qint64, qint64>> pendingRanges; // byte ranges [begin, end) to download
+    qint64 rangeEnd = 0;
+    qint64 streamBegin = 0; // begin of Range requested by httpReply
+    bool isStreamAccepted = false; // see acceptStreamReply()
+    bool isRangeMismatched = false;
+    int nextChunkToMark = 0;
+    QString fileMd5; // md5 provided by playurl API. may be empty
+    QList<std::pair<qint64, qint64>> verifyWindows; // byte ranges [begin, end) left to verify. see verifyResume()
+
+    // stall detection and reconnect. see checkThroughput() and reconnect()
+    qint64 lastCheckedBytesCnt = 0;
+    int noProgressTicks = 0;
+    bool isStalled = false;
+    int stallCnt = 0;
+    int reconnectCnt = 0;
+    int consecutiveReconnectCnt = 0;
+    QTimer *reconnectTimer = nullptr;
+
 public:
+    ~VideoDownloadTask();
+
+    void stopDownload() override;
     void removeFile() override;
     int estimateRemainingSeconds(qint64 downBytesPerSec) const override;
     double getProgress() const override;
     QString getProgressStr() const override;
     QString getQnDescription() const override;
+    qint64 getBufferedBytesCnt() const override;
+    int getStallCnt() const override { return stallCnt; }
+    int getReconnectCnt() const override { return reconnectCnt; }
+    bool isReconnecting() const override;
 
     static QnList getAllPossibleQn();
     static QString getQnDescription(int qn);
     static QnInfo getQnInfoFromPlayUrlInfo(const QJsonObject &);
+    static QList<QUrl> mirrorsOfDurl(const QJsonObject &durlObj);
 
     QJsonObject toJsonObj() const override;
 
@@ -178,13 +355,67 @@ protected:
     using AbstractVideoDownloadTask::AbstractVideoDownloadTask; // ctor
 
     std::unique_ptr<QFile> file;
+    BufferedWriter writer;
     std::unique_ptr<QFile> openFileForWrite();
 
     void parsePlayUrlInfo(const QJsonObject &data) override;
-    void startDownloadStream(const QUrl &url);
+
+    /**
+     * @brief load or create the chunk map, then set pendingRanges to the holes in file
+     */
+    bool prepareChunkMap();
+    void startDownloadStream();
+    void closeFile();
+
+    /**
+     * @return first bytes of the first completed chunk and last bytes of the last one,
+     * or empty if no chunk is completed
+     */
+    QList<std::pair<qint64, qint64>> resumeVerifyWindows() const;
+
+    /**
+     * @brief fetch bytes of verifyWindows one by one and compare them with file.
+     * Restart from scratch if they differ (the file on CDN has changed).
+     */
+    void verifyResume();
+    bool restartFromScratch();
+    void startNextRange();
+    void requestStream();
+
+    /**
+     * @brief check status and Content-Range of stream reply before its data is written to file.
+     * reply that ignores Range is aborted (isRangeMismatched set), body of an error reply is discarded
+     * @return true if data of reply can be written
+     */
+    bool acceptStreamReply(QNetworkReply *reply);
+
+    /**
+     * @return false if failed to update chunk map
+     */
+    bool markCompletedChunks();
     void onStreamReadyRead();
     void onStreamFinished();
 
+    /**
+     * @brief write data received to file. errorOccurred() is emitted if failed
+     */
+    bool writeStreamData(const QByteArray &data);
+
+    /**
+     * @brief switch to next mirror if throughput of current one is too low.
+     * abort the connection as stalled if no data arrives or no mirror is left to switch to
+     */
+    void checkThroughput();
+
+    /**
+     * @brief schedule reconnect (with exponential backoff) after a connection failed.
+     * file is kept open and download continues from its current position (only data of validated
+     * ranged replies is written) with a refreshed playurl. restarted from scratch if the file on CDN changed.
+     * @return false if the failure is not retriable or too many reconnects failed
+     */
+    bool reconnect(QNetworkReply *failedReply);
+    void refreshPlayUrl();
+
     bool checkQn(int qnFromReply);
     bool checkSize(qint64 sizeFromReply);
 };
@@ -203,11 +434,14 @@ public:
     QJsonObject toJsonObj() const override;
     PgcDownloadTask(const QJsonObject &json);
 
+    static QString playUrlInfoUrl(qint64 epId, int qn);
     static QNetworkReply *getPlayUrlInfo(qint64 epId, int qn);
     QNetworkReply *getPlayUrlInfo() const override;
+    QString getPlayUrlInfoUrl() const override;
 
     static const QString playUrlInfoDataKey;
     QString getPlayUrlInfoDataKey() const override;
+    QString getPlayUrlInfoCacheKey() const override;
 };
 
 
@@ -225,11 +459,14 @@ public:
     QJsonObject toJsonObj() const override;
     PugvDownloadTask(const QJsonObject &json);
 
+    static QString playUrlInfoUrl(qint64 epId, int qn);
     static QNetworkReply *getPlayUrlInfo(qint64 epId, int qn);
     QNetworkReply *getPlayUrlInfo() const override;
+    QString getPlayUrlInfoUrl() const override;
 
     static const QString playUrlInfoDataKey;
     QString getPlayUrlInfoDataKey() const override;
+    QString getPlayUrlInfoCacheKey() const override;
 };
 
 class UgcDownloadTask : public VideoDownloadTask
@@ -246,34 +483,56 @@ public:
     QJsonObject toJsonObj() const override;
     UgcDownloadTask(const QJsonObject &json);
 
+    static QString playUrlInfoUrl(qint64 aid, qint64 cid, int qn);
     static QNetworkReply *getPlayUrlInfo(qint64 aid, qint64 cid, int qn);
     QNetworkReply *getPlayUrlInfo() const override;
+    QString getPlayUrlInfoUrl() const override;
 
     static const QString playUrlInfoDataKey;
     QString getPlayUrlInfoDataKey() const override;
+    QString getPlayUrlInfoCacheKey() const override;
 };
 
 
 class QSaveFile;
+class CbzWriter;
 class ComicDownloadTask : public AbstractDownloadTask
 {
     Q_OBJECT
 
+public:
+    static constexpr int ImgTokenBatchSize = 20;
+    static constexpr int MaxImgFetchesInFlight = 4;
+
 private:
+    struct ImgFetch
+    {
+        int index;
+        QString fileName;
+        QNetworkReply *reply = nullptr;
+        std::unique_ptr<QSaveFile> file; // null if written into cbz
+        BufferedWriter writer;
+        QByteArray data; // image is added to cbz as a whole when finished
+        qint64 recvBytesCnt = 0;
+    };
+
+    bool isCbz = false; // images are written into <path> (a .cbz file) instead of directory <path>
+    std::unique_ptr<CbzWriter> cbz;
+
     int totalImgCnt = 0;
     int finishedImgCnt = 0;
-    int curImgRecvBytesCnt = 0;
-    int curImgTotalBytesCnt = 0;
-    qint64 bytesCntTillLastImg = 0;
+    qint64 finishedBytesCnt = 0;
 
     QVector<QString> imgRqstPaths;
-    std::unique_ptr<QSaveFile> file;
+    QVector<qint64> imgSizes; // -1 if not finished
+    int nextTokenImgIdx = 0;
+    QList<std::pair<int, QString>> readyImgs; // (index, url with token)
+    std::vector<std::unique_ptr<ImgFetch>> imgFetches;
 
 public:
     const qint64 comicId;
     const qint64 epId;
-    ComicDownloadTask(qint64 comicId, qint64 epId, const QString &path)
-        : AbstractDownloadTask(path), comicId(comicId), epId(epId) {}
+    ComicDownloadTask(qint64 comicId, qint64 epId, const QString &path);
     ~ComicDownloadTask();
 
     QJsonObject toJsonObj() const override;
@@ -287,20 +546,45 @@ public:
     int estimateRemainingSeconds(qint64 downBytesPerSec) const override;
     double getProgress() const override;
     QString getProgressStr() const override;
+    qint64 getBufferedBytesCnt() const override;
 
     QString getQnDescription() const override;
 
 private slots:
     void getImgInfoFinished();
-    void getImgTokenFinished();
-    void onImgReadyRead();
-    void downloadImgFinished();
 
 private:
-    void downloadNextImg();
-    void abortCurrentImg();
+    void requestImgIndex();
+
+    /**
+     * @brief request tokens of next ImgTokenBatchSize images in one request (httpReply)
+     */
+    void requestImgTokens();
+
+    /**
+     * @brief download images with token ready, at most MaxImgFetchesInFlight at the same time
+     */
+    void startImgFetches();
+    void onImgFetchSlotReleased();
+    bool canStartImgFetch() const;
+    void onImgReadyRead(ImgFetch *fetch);
+    void onImgFetchFinished(ImgFetch *fetch);
+    void abortImgFetches();
+    qint64 inFlightBytesCnt() const;
+    void finishDownload();
 
     std::unique_ptr<QSaveFile> openFileForWrite(const QString &fileName);
+
+    /**
+     * @brief open (or resume) the cbz file. images already in it are marked finished
+     */
+    bool openCbz();
+
+    /**
+     * @brief mark images whose file exists and is complete as finished, and the others not finished
+     */
+    void checkExistingImgs();
+    bool isOwnImgFile(const QFileInfo &fileInfo) const;
 };
 
 
@@ -3,6 +3,7 @@
 #include "utils.h"
 #include "Extractor.h"
 #include "Network.h"
+#include "UrlClassifier.h"
 #include <QtNetwork>
 
 using QRegExp = QRegularExpression;
@@ -37,106 +38,44 @@ void Extractor::urlNotSupported()
 
 void Extractor::start(QString url)
 {
-    url = url.trimmed();
-    QRegularExpressionMatch m;
-
-    // bad coding style?!
-
-    // try to match short forms
-    if ((m = QRegExp("^(?:BV|bv)([a-zA-Z0-9]+)$").match(url)).hasMatch()) {
-        return startUgcByBvId("BV" + m.captured(1));
-    }
-    if ((m = QRegExp(R"(^av(\d+)$)").match(url)).hasMatch()) {
-        return startUgcByAvId(m.captured(1).toLongLong());
-    }
-    if ((m = QRegExp(R"(^(ss|ep)(\d+)$)").match(url)).hasMatch()) {
-        auto idType = (m.captured(1) == "ss" ? PgcIdType::SeasonId : PgcIdType::EpisodeId);
-        return startPgc(idType, m.captured(2).toLongLong());
-    }
-    if ((m = QRegExp(R"(^live(\d+)$)").match(url)).hasMatch()) {
-        return startLive(m.captured(1).toLongLong());
-    }
-
-    if (!url.startsWith("http://") && !url.startsWith("https://")) {
-        parseUrl("https://" + url);
-    } else {
-        parseUrl(url);
-    }
+    startClassified(UrlClassifier::classify(url.trimmed()));
 }
 
 void Extractor::parseUrl(QUrl url)
 {
-    auto host = url.authority().toLower();
-    auto path = url.path();
-    auto query = QUrlQuery(url);
-    QRegularExpressionMatch m;
-
-    if (QRegExp(R"(^(?:www\.|m\.)?bilibili\.com$)").match(host).hasMatch()) {
-        if ((m = QRegExp(R"(^/bangumi/play/(ss|ep)(\d+)/?$)").match(path)).hasMatch()) {
-            auto idType = (m.captured(1) == "ss" ? PgcIdType::SeasonId : PgcIdType::EpisodeId);
-            return startPgc(idType, m.captured(2).toLongLong());
-        }
-        if ((m = QRegExp(R"(^/bangumi/media/md(\d+)/?$)").match(path)).hasMatch()) {
-            return startPgcByMdId(m.captured(1).toLongLong());
-        }
-        if ((m = QRegExp(R"(^/cheese/play/(ss|ep)(\d+)/?$)").match(path)).hasMatch()) {
-            auto idType = (m.captured(1) == "ss" ? PugvIdType::SeasonId : PugvIdType::EpisodeId);
-            return startPugv(idType, m.captured(2).toLongLong());
-        }
-
-        focusItemId = query.queryItemValue("p").toLongLong();
-        if ((m = QRegExp(R"(^/(?:(?:s/)?video/)?(?:BV|bv)([a-zA-Z0-9]+)/?$)").match(path)).hasMatch()) {
-            return startUgcByBvId("BV" + m.captured(1));
-        }
-        if ((m = QRegExp(R"(^/(?:(?:s/)?video/)?av(\d+)/?$)").match(path)).hasMatch()) {
-            return startUgcByAvId(m.captured(1).toLongLong());
-        }
-//        if ((m = QRegExp(R"(^$)").match(path)).hasMatch()) {
-//        }
-        return urlNotSupported();
-    }
-
-    if (host == "bangumi.bilibili.com") {
-        if ((m = QRegExp(R"(^/anime/(\d+)/?$)").match(path)).hasMatch()) {
-            return startPgc(PgcIdType::SeasonId, m.captured(1).toLongLong());
-        }
-        return urlNotSupported();
-    }
-
-    if (host == "live.bilibili.com") {
-        if ((m = QRegExp(R"(^/(?:h5/)?(\d+)/?$)").match(path)).hasMatch()) {
-            return startLive(m.captured(1).toLongLong());
-        }
-        if ((m = QRegExp(R"(^/blackboard/activity-.*\.html$)").match(path)).hasMatch()) {
-            return startLiveActivity(url);
-        }
-
-        return urlNotSupported();
-    }
-
-    if (host == "b23.tv") {
-        if ((m = QRegExp(R"(^/(ss|ep)(\d+)$)").match(path)).hasMatch()) {
-            auto idType = (m.captured(1) == "ss" ? PugvIdType::SeasonId : PugvIdType::EpisodeId);
-            return startPgc(idType, m.captured(2).toLongLong());
-        } else {
-            return tryRedirect(url);
-        }
-    }
-
-    if (host == "manga.bilibili.com") {
-        if ((m = QRegExp(R"(^/(?:m/)?detail/mc(\d+)/?$)").match(path)).hasMatch()) {
-            focusItemId = query.queryItemValue("epId").toLongLong();
-            return startComic(m.captured(1).toLongLong());
-        }
-        if ((m = QRegExp(R"(^/(?:m/)?mc(\d+)/(\d+)/?$)").match(path)).hasMatch()) {
-            focusItemId = m.captured(2).toLongLong();
-            return startComic(m.captured(1).toLongLong());
-        }
-        return urlNotSupported();
-    }
+    startClassified(UrlClassifier::classifyUrl(url));
+}
 
-    if (host == "b22.top") {
-        return tryRedirect(url);
+void Extractor::startClassified(const UrlClassifier::Result &input)
+{
+    using Kind = UrlClassifier::Kind;
+
+    focusItemId = input.focusItemId;
+    switch (input.kind) {
+    case Kind::UgcBvId:
+        return startUgcByBvId(input.bvid);
+    case Kind::UgcAvId:
+        return startUgcByAvId(input.id);
+    case Kind::PgcSeasonId:
+        return startPgc(PgcIdType::SeasonId, input.id);
+    case Kind::PgcEpisodeId:
+        return startPgc(PgcIdType::EpisodeId, input.id);
+    case Kind::PgcMediaId:
+        return startPgcByMdId(input.id);
+    case Kind::PugvSeasonId:
+        return startPugv(PugvIdType::SeasonId, input.id);
+    case Kind::PugvEpisodeId:
+        return startPugv(PugvIdType::EpisodeId, input.id);
+    case Kind::LiveRoom:
+        return startLive(input.id);
+    case Kind::LiveActivity:
+        return startLiveActivity(input.url);
+    case Kind::Comic:
+        return startComic(input.id);
+    case Kind::Redirect:
+        return tryRedirect(input.url);
+    case Kind::Unsupported:
+        break;
     }
 
 //    auto tenkinokoWebAct = "www.bilibili.com/blackboard/topic/activity-jjR1nNRUF.html";
@@ -147,6 +86,7 @@ void Extractor::parseUrl(QUrl url)
 
 void Extractor::abort()
 {
+    isParsing = false;
     if (httpReply != nullptr) {
         httpReply->abort();
     }
@@ -169,7 +109,34 @@ QJsonObject Extractor::getReplyJsonObj(const QString &requiredKey)
     }
 
     const auto [json, errorString] = Network::Bili::parseReply(reply, requiredKey);
+    return checkReplyJsonObj(json, errorString, requiredKey);
+}
+
+void Extractor::parseReplyAsync(const QString &requiredKey, void (Extractor::*onParsed)(const QJsonObject &))
+{
+    auto reply = httpReply;
+    httpReply = nullptr;
+    reply->deleteLater();
+    if (reply->error() == QNetworkReply::OperationCanceledError) {
+        return;
+    }
 
+    isParsing = true;
+    Network::Bili::parseReplyAsync(reply, requiredKey, this, [=](const QJsonObject &json, const QString &errorString) {
+        if (!isParsing) {
+            // aborted
+            return;
+        }
+        isParsing = false;
+        auto obj = checkReplyJsonObj(json, errorString, requiredKey);
+        if (!obj.isEmpty()) {
+            (this->*onParsed)(obj);
+        }
+    });
+}
+
+QJsonObject Extractor::checkReplyJsonObj(const QJsonObject &json, const QString &errorString, const QString &requiredKey)
+{
     if (!errorString.isNull()) {
         emit errorOccurred(errorString);
         return QJsonObject();
@@ -251,7 +218,7 @@ void Extractor::startPgc(PgcIdType idType, qint64 id)
     auto api = "https://api.bilibili.com/pgc/view/web/season";
     auto query = QString("?%1=%2").arg(idType == PgcIdType::SeasonId ? "season_id" : "ep_id").arg(id);
     httpReply = Network::Bili::get(api + query);
-    connect(httpReply, &QNetworkReply::finished, this, &Extractor::pgcFinished);
+    connect(httpReply, &QNetworkReply::finished, this, [this]{ parseReplyAsync("result", &Extractor::pgcFinished); });
 }
 
 static int epFlags(int epStatus)
@@ -295,13 +262,8 @@ static QString epTitle (const QString &title, const QString &longTitle) {
     }
 }
 
-void Extractor::pgcFinished()
+void Extractor::pgcFinished(const QJsonObject &res)
 {
-    auto res = getReplyJsonObj("result");
-    if (res.isEmpty()) {
-        return;
-    }
-
     auto type = res["type"].toInt();
     QString indexSuffix = (type == 1 || type == 4) ? "话" : "集";
 
@@ -466,10 +428,14 @@ void Extractor::liveActivityFinished()
         emit errorOccurred("解析活动页面失败。<br>建议尝试数字房间号链接, 比如<em>live.bilibili.com/22586886</em>");
     };
 
-    auto m = QRegExp(R"(window.__BILIACT_ENV__\s?=([^;]+);)").match(text);
+    static const QRegExp envRegex(R"(window.__BILIACT_ENV__\s?=([^;]+);)");
+    static const QRegExp jumpUrlRegex(R"(\\?"jumpUrl\\?"\s?:\s?\\?"([^"\\]+)\\?")");
+    static const QRegExp roomIdRegex(R"(\\?"defaultRoomId\\?"\s?:\s?\\?"?(\d+))");
+
+    auto m = envRegex.match(text);
     auto platform = m.captured(1); // null if no match
     if (platform.contains("H5")) {
-        m = QRegExp(R"(\\?"jumpUrl\\?"\s?:\s?\\?"([^"\\]+)\\?")").match(text, m.capturedEnd(0));
+        m = jumpUrlRegex.match(text, m.capturedEnd(0));
         if (m.hasMatch()) {
             startLiveActivity(m.captured(1));
         } else {
@@ -478,7 +444,7 @@ void Extractor::liveActivityFinished()
         return;
     }
 
-    m = QRegExp(R"(\\?"defaultRoomId\\?"\s?:\s?\\?"?(\d+))").match(text, m.capturedEnd(0));
+    m = roomIdRegex.match(text, m.capturedEnd(0));
     if (!m.hasMatch()) {
         parseFailed();
         return;
@@ -496,16 +462,11 @@ void Extractor::startPugv(PugvIdType idType, qint64 id)
     auto api = "https://api.bilibili.com/pugv/view/web/season";
     auto query = QString("?%1=%2").arg(idType == PugvIdType::SeasonId ? "season_id" : "ep_id").arg(id);
     httpReply = Network::Bili::get(api + query);
-    connect(httpReply, &QNetworkReply::finished, this, &Extractor::pugvFinished);
+    connect(httpReply, &QNetworkReply::finished, this, [this]{ parseReplyAsync("data", &Extractor::pugvFinished); });
 }
 
-void Extractor::pugvFinished()
+void Extractor::pugvFinished(const QJsonObject &data)
 {
-    auto data = getReplyJsonObj("data");
-    if (data.isEmpty()) {
-        return;
-    }
-
     if (!data["user_status"].toObject()["payed"].toInt(1)) {
         emit errorOccurred("未登录或未购买该课程");
         return;
@@ -542,16 +503,11 @@ void Extractor::startUgcByAvId(qint64 avid)
 void Extractor::startUgc(const QString &query)
 {
     httpReply = Network::Bili::get("https://api.bilibili.com/x/web-interface/view?" + query);
-    connect(httpReply, &QNetworkReply::finished, this, &Extractor::ugcFinished);
+    connect(httpReply, &QNetworkReply::finished, this, [this]{ parseReplyAsync("data", &Extractor::ugcFinished); });
 }
 
-void Extractor::ugcFinished()
+void Extractor::ugcFinished(const QJsonObject &data)
 {
-    auto data = getReplyJsonObj("data");
-    if (data.isEmpty()) {
-        return;
-    }
-
     auto isInteractVideo = data["rights"].toObject()["is_stein_gate"].toInt();
     if (isInteractVideo) {
         emit errorOccurred("不支持互动视频");
@@ -600,7 +556,7 @@ void Extractor::startComic(int comicId)
 {
     auto url = "https://manga.bilibili.com/twirp/comic.v1.Comic/ComicDetail?device=pc&platform=web";
     httpReply = Network::Bili::postJson(QString(url), QJsonObject{{"comic_id", comicId}});
-    connect(httpReply, &QNetworkReply::finished, this, &Extractor::comicFinished);
+    connect(httpReply, &QNetworkReply::finished, this, [this]{ parseReplyAsync("data", &Extractor::comicFinished); });
 }
 
 enum ComicType { Comic, Video };
@@ -619,13 +575,8 @@ static QString comicEpTitle(const QString &shortTitle, const QString &title, int
     return (title.isEmpty() ? shortTitle : shortTitle + " " + title);
 }
 
-void Extractor::comicFinished()
+void Extractor::comicFinished(const QJsonObject &data)
 {
-    auto data = getReplyJsonObj("data");
-    if (data.isEmpty()) {
-        return;
-    }
-
     if (data["type"].toInt() == ComicType::Video) {
         emit errorOccurred("暂不支持Vomic");
         return;
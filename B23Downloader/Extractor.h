@@ -5,6 +5,7 @@
 #include <utility>
 
 class QNetworkReply;
+namespace UrlClassifier { struct Result; }
 
 namespace ContentItemFlag
 {
@@ -93,10 +94,19 @@ private:
     qint64 focusItemId = 0;
     std::unique_ptr<Result> result;
     QNetworkReply *httpReply = nullptr;
+    bool isParsing = false;
     QJsonObject getReplyJsonObj(const QString &requiredKey = QString());
+    QJsonObject checkReplyJsonObj(const QJsonObject &json, const QString &errorString, const QString &requiredKey);
+
+    /**
+     * @brief parses httpReply with Network::Bili::parseReplyAsync(), and passes the (non-empty)
+     * requiredKey object to onParsed. for replies that can be large (episode lists)
+     */
+    void parseReplyAsync(const QString &requiredKey, void (Extractor::*onParsed)(const QJsonObject &));
     QString getReplyText();
 
     void parseUrl(QUrl url);
+    void startClassified(const UrlClassifier::Result &input);
     void tryRedirect(const QUrl &url);
     void startUgc(const QString &query);
     void startUgcByBvId(const QString &bvid);
@@ -110,13 +120,14 @@ private:
 
     void urlNotSupported();
 
+    void ugcFinished(const QJsonObject &data);
+    void pgcFinished(const QJsonObject &res);
+    void pugvFinished(const QJsonObject &data);
+    void comicFinished(const QJsonObject &data);
+
 private slots:
-    void ugcFinished();
-    void pgcFinished();
-    void pugvFinished();
     void liveFinished();
     void liveActivityFinished();
-    void comicFinished();
 };
 
 #endif // EXTRACTOR_H
@@ -477,7 +477,7 @@ void Flv::AnchoredAmfNumber::Anchor::update(double val)
 
 
 FlvLiveDownloadDelegate::FlvLiveDownloadDelegate(QIODevice &in_, CreateFileHandler createFileHandler_)
-    :in(in_), createFileHandler(createFileHandler_)
+    :in(&in_), createFileHandler(createFileHandler_)
 {
     bytesRequired = Flv::FileHeader::BytesCnt + 4; // FlvFileHeader + prevTagSize (UI32)
 }
@@ -515,11 +515,25 @@ qint64 FlvLiveDownloadDelegate::getReadBytesCnt()
     return readBytesCnt;
 }
 
+qint64 FlvLiveDownloadDelegate::getLastGapInMSec()
+{
+    return lastGap;
+}
+
+void FlvLiveDownloadDelegate::resume(QIODevice &newIn)
+{
+    in = &newIn;
+    state = State::Begin;
+    bytesRequired = Flv::FileHeader::BytesCnt + 4;
+    isResuming = true;
+    lastGap = -1;
+}
+
 bool FlvLiveDownloadDelegate::newDataArrived()
 {
     bool noError = true;
     while (noError) {
-        if (in.bytesAvailable() < bytesRequired) {
+        if (in->bytesAvailable() < bytesRequired) {
             break;
         }
         auto tmp = bytesRequired;
@@ -543,7 +557,7 @@ bool FlvLiveDownloadDelegate::newDataArrived()
             break;
         case State::ReadingDummy:
             state = State::ReadingTagHeader;
-            in.skip(bytesRequired);
+            in->skip(bytesRequired);
             bytesRequired = Flv::TagHeader::BytesCnt;
             break;
         case State::Stopped:
@@ -619,8 +633,8 @@ void FlvLiveDownloadDelegate::stop()
 
 bool FlvLiveDownloadDelegate::handleFileHeader()
 {
-    Flv::FileHeader flvFileHeader(in);
-    Flv::readUInt32(in); // read dummy prev tag size (UInt32)
+    Flv::FileHeader flvFileHeader(*in);
+    Flv::readUInt32(*in); // read dummy prev tag size (UInt32)
     if (!flvFileHeader.valid) {
         error = Error::FlvParseError;
         return false;
@@ -644,7 +658,7 @@ bool FlvLiveDownloadDelegate::handleFileHeader()
 
 bool FlvLiveDownloadDelegate::handleTagHeader()
 {
-    if (!tagHeader.readFrom(in)) {
+    if (!tagHeader.readFrom(*in)) {
         error = Error::FlvParseError;
         return false;
     }
@@ -672,8 +686,15 @@ bool FlvLiveDownloadDelegate::handleTagBody()
 
 bool FlvLiveDownloadDelegate::handleScriptTagBody()
 {
-    onMetaDataScript = make_unique<Flv::ScriptBody>(in);
-    Flv::readUInt32(in); // read prevTagSize (UInt32)
+    if (isResuming && onMetaDataScript != nullptr) {
+        // keep onMetaData (and anchors in it) of current file
+        Flv::ScriptBody discarded(*in);
+        Flv::readUInt32(*in); // read prevTagSize (UInt32)
+        return true;
+    }
+
+    onMetaDataScript = make_unique<Flv::ScriptBody>(*in);
+    Flv::readUInt32(*in); // read prevTagSize (UInt32)
     if (!onMetaDataScript->isOnMetaData()) {
         error = Error::FlvParseError;
         return false;
@@ -701,35 +722,81 @@ bool FlvLiveDownloadDelegate::handleScriptTagBody()
     return true;
 }
 
+void FlvLiveDownloadDelegate::updateTimestampBase()
+{
+    if (!isTimestampBaseValid) {
+        isTimestampBaseValid = true;
+        timestampBase = tagHeader.timestamp;
+    } else if (isResuming) {
+        isResuming = false;
+        auto gap = static_cast<qint64>(tagHeader.timestamp) - lastRawTimestamp;
+        if (gap > 0 && gap <= MaxResumeGap) {
+            // same time base (time since live started): keep it, so that the gap is kept in output
+            lastGap = gap;
+        } else {
+            auto curDuration = std::max(curFileAudioDuration, curFileVideoDuration);
+            timestampBase = tagHeader.timestamp - (curDuration + ResumeTimestampGap);
+        }
+    }
+    lastRawTimestamp = tagHeader.timestamp;
+}
+
+void FlvLiveDownloadDelegate::updateSeqHeader(QByteArray &seqHeaderBuffer, const QByteArray &seqHeader)
+{
+    if (seqHeader == seqHeaderBuffer && isResuming) {
+        return; // repeated by the resumed stream. timestamp 0 in the middle of file breaks players
+    }
+    if (!seqHeaderBuffer.isEmpty() && seqHeader != seqHeaderBuffer && out != nullptr) {
+        // encoder restarted with other parameters. new headers begin the next file
+        isNewSegmentRequired = true;
+    }
+    seqHeaderBuffer = seqHeader;
+    if (out != nullptr && !isNewSegmentRequired) {
+        out->write(seqHeaderBuffer);
+    }
+}
+
+bool FlvLiveDownloadDelegate::startNewSegment()
+{
+    isNewSegmentRequired = false;
+    isResuming = false;
+    lastGap = -1;
+    if (!openNewFileToWrite()) {
+        return false;
+    }
+    totalDuration += std::max(curFileAudioDuration, curFileVideoDuration);
+    timestampBase = tagHeader.timestamp;
+    lastRawTimestamp = tagHeader.timestamp;
+    curFileAudioDuration = 0;
+    curFileVideoDuration = 0;
+    prevKeyframeTimestamp = -LeastKeyframeInterval;
+    return true;
+}
+
 bool FlvLiveDownloadDelegate::handleAudioTagBody()
 {
-    auto audioHeader = Flv::AudioTagHeader(in);
+    auto audioHeader = Flv::AudioTagHeader(*in);
     auto writeTagTo = [this, &audioHeader](QIODevice &outDev) {
         tagHeader.writeTo(outDev);
         audioHeader.writeTo(outDev);
         auto audioDataSize = tagHeader.dataSize - audioHeader.rawData.size();
-        outDev.write(in.read(audioDataSize + 4)); // audio data + prevDataSize
+        outDev.write(in->read(audioDataSize + 4)); // audio data + prevDataSize
     };
 
     if (audioHeader.isAacSequenceHeader) {
         tagHeader.timestamp = 0;
-        auto prevSeqHeader = std::move(aacSeqHeaderBuffer);
-
-        QBuffer buffer(&aacSeqHeaderBuffer);
+        QByteArray seqHeader;
+        QBuffer buffer(&seqHeader);
         buffer.open(QIODevice::WriteOnly);
         writeTagTo(buffer);
-
-        if (!prevSeqHeader.isEmpty() && prevSeqHeader != aacSeqHeaderBuffer) {
-            error = Error::FlvParseError;
-            return false;
-        }
-        if (out != nullptr) {
-            out->write(aacSeqHeaderBuffer);
-        }
+        updateSeqHeader(aacSeqHeaderBuffer, seqHeader);
     } else {
-        if (!isTimestampBaseValid) {
-            isTimestampBaseValid = true;
-            timestampBase = tagHeader.timestamp;
+        if (isNewSegmentRequired) {
+            if (!startNewSegment()) {
+                return false;
+            }
+        } else {
+            updateTimestampBase();
         }
         tagHeader.timestamp -= timestampBase;
         if (tagHeader.timestamp < curFileAudioDuration) {
@@ -747,7 +814,7 @@ bool FlvLiveDownloadDelegate::handleAudioTagBody()
 
 bool FlvLiveDownloadDelegate::handleVideoTagBody()
 {
-    auto videoHeader = Flv::VideoTagHeader(in);
+    auto videoHeader = Flv::VideoTagHeader(*in);
     if (videoHeader.codecId == Flv::VideoCodecId::HEVC) {
         error = Error::HevcNotSupported;
         return false;
@@ -757,29 +824,23 @@ bool FlvLiveDownloadDelegate::handleVideoTagBody()
         tagHeader.writeTo(outDev);
         videoHeader.writeTo(outDev);
         auto audioDataSize = tagHeader.dataSize - videoHeader.rawData.size();
-        outDev.write(in.read(audioDataSize + 4)); // audio data + prevDataSize
+        outDev.write(in->read(audioDataSize + 4)); // audio data + prevDataSize
     };
 
     if (videoHeader.isAvcSequenceHeader()) {
         tagHeader.timestamp = 0;
-        auto prevSeqHeader = std::move(avcSeqHeaderBuffer);
-
-        QBuffer buffer(&avcSeqHeaderBuffer);
+        QByteArray seqHeader;
+        QBuffer buffer(&seqHeader);
         buffer.open(QIODevice::WriteOnly);
         writeTagTo(buffer);
-
-        if (!prevSeqHeader.isEmpty() && prevSeqHeader != avcSeqHeaderBuffer) {
-            error = Error::FlvParseError;
-            return false;
-        }
-        if (out != nullptr) {
-            out->write(avcSeqHeaderBuffer);
-        }
-
+        updateSeqHeader(avcSeqHeaderBuffer, seqHeader);
     } else {
-        if (!isTimestampBaseValid) {
-            isTimestampBaseValid = true;
-            timestampBase = tagHeader.timestamp;
+        if (isNewSegmentRequired) {
+            if (!startNewSegment()) {
+                return false;
+            }
+        } else {
+            updateTimestampBase();
         }
         tagHeader.timestamp -= timestampBase;
         if (tagHeader.timestamp < curFileVideoDuration) {
@@ -378,12 +378,16 @@ class QFileDevice;
  */
 class FlvLiveDownloadDelegate
 {
-    QIODevice &in;
+    QIODevice *in;
     std::unique_ptr<QFileDevice> out;
 
 public:
     static constexpr auto MaxKeyframes = 6000;
     static constexpr auto LeastKeyframeInterval = 2500; // ms
+    // timestamps of a resumed stream are taken as continuing those of the previous one
+    // if the gap is within MaxResumeGap, otherwise rebased to ResumeTimestampGap after written ones
+    static constexpr auto MaxResumeGap = 60000; // ms
+    static constexpr auto ResumeTimestampGap = 100; // ms
     using CreateFileHandler = std::function<std::unique_ptr<QFileDevice>()>;
 
 
@@ -399,10 +403,23 @@ public:
     bool newDataArrived();
     void stop();
 
+    /**
+     * @brief continue with a new input stream (after the previous one ended) in the same output file.
+     * FLV header, onMetaData and unchanged sequence headers of the new stream are skipped,
+     * and timestamps of the new stream continue from those written.
+     * If sequence headers changed (encoder restarted), data from then on is written to a new file.
+     */
+    void resume(QIODevice &newIn);
+
     QString errorString();
     qint64 getDurationInMSec();
     qint64 getReadBytesCnt();
 
+    /**
+     * @return media time (ms) lost between the streams at last resume(), -1 if unknown
+     */
+    qint64 getLastGapInMSec();
+
 private:
     enum class Error { NoError, FlvParseError, SaveFileOpenError, HevcNotSupported };
     Error error = Error::NoError;
@@ -424,6 +441,13 @@ private:
      */
     void updateMetaDataKeyframes(qint64 filePos, int timeInMSec);
     void updateMetaDataDuration();
+    void updateTimestampBase();
+    void updateSeqHeader(QByteArray &seqHeaderBuffer, const QByteArray &seqHeader);
+
+    /**
+     * @brief continue in a new file whose timestamps start from the current tag
+     */
+    bool startNewSegment();
 
     bool handleFileHeader();
     bool handleTagHeader();
@@ -439,6 +463,10 @@ private:
     int curFileVideoDuration = 0; // ms
     qint64 totalDuration = 0;     // ms
     int prevKeyframeTimestamp = -LeastKeyframeInterval;
+    int lastRawTimestamp = 0;
+    bool isResuming = false;
+    bool isNewSegmentRequired = false; // see updateSeqHeader()
+    qint64 lastGap = -1;
 
     Flv::TagHeader tagHeader;
 
@@ -0,0 +1,113 @@
+#include "LiveMonitor.h"
+#include "Network.h"
+#include "Settings.h"
+#include <QtNetwork>
+
+static constexpr int DefaultInterval = 60; // s
+static constexpr int MinInterval = 10; // s
+static constexpr double Jitter = 0.2; // +-20% of the delay between batches
+
+static const QString DefaultApiBase = "https://api.live.bilibili.com";
+
+LiveMonitor::LiveMonitor(QObject *parent)
+    : QObject(parent)
+{
+    pollTimer = new QTimer(this);
+    pollTimer->setSingleShot(true);
+    connect(pollTimer, &QTimer::timeout, this, &LiveMonitor::poll);
+    reloadSettings();
+}
+
+LiveMonitor::~LiveMonitor()
+{
+    if (httpReply != nullptr) {
+        httpReply->disconnect(this);
+        httpReply->abort();
+        httpReply->deleteLater();
+    }
+}
+
+void LiveMonitor::reloadSettings()
+{
+    auto settings = Settings::inst();
+    rooms.clear();
+    for (auto &room : settings->value("monitor/rooms").toStringList()) {
+        bool ok;
+        auto roomId = room.trimmed().toLongLong(&ok);
+        if (ok && roomId > 0 && !rooms.contains(roomId)) {
+            rooms.append(roomId);
+        }
+    }
+    interval = std::max(settings->value("monitor/interval", DefaultInterval).toInt(), MinInterval) * 1000;
+    apiBase = settings->value("monitor/apiBase", DefaultApiBase).toString();
+    nextBatchIndex = 0;
+
+    if (rooms.isEmpty()) {
+        pollTimer->stop();
+    } else if (!pollTimer->isActive() && httpReply == nullptr) {
+        pollTimer->start(0);
+    }
+}
+
+void LiveMonitor::scheduleNextPoll()
+{
+    if (rooms.isEmpty()) {
+        return;
+    }
+    auto batchCnt = (rooms.size() + BatchSize - 1) / BatchSize;
+    auto delay = static_cast<double>(interval) / batchCnt;
+    delay *= 1.0 + Jitter * (2.0 * QRandomGenerator::global()->generateDouble() - 1.0);
+    pollTimer->start(static_cast<int>(delay));
+}
+
+void LiveMonitor::poll()
+{
+    if (rooms.isEmpty()) {
+        return;
+    }
+    if (nextBatchIndex * BatchSize >= rooms.size()) {
+        nextBatchIndex = 0;
+    }
+
+    QUrlQuery query;
+    for (auto roomId : rooms.mid(nextBatchIndex * BatchSize, BatchSize)) {
+        query.addQueryItem("room_ids", QString::number(roomId));
+    }
+    query.addQueryItem("req_biz", "web_room_componet");
+    nextBatchIndex++;
+
+    QUrl url(apiBase + "/xlive/web-room/v1/index/getRoomBaseInfo");
+    url.setQuery(query);
+    httpReply = Network::Bili::get(url);
+    connect(httpReply, &QNetworkReply::finished, this, &LiveMonitor::pollFinished);
+}
+
+void LiveMonitor::pollFinished()
+{
+    auto reply = httpReply;
+    httpReply = nullptr;
+    reply->deleteLater();
+    scheduleNextPoll();
+
+    const auto [json, errorString] = Network::Bili::parseReply(reply, "data");
+    if (!errorString.isNull()) {
+        qDebug() << "live monitor:" << errorString;
+        return;
+    }
+
+    auto byRoomIds = json["data"].toObject()["by_room_ids"].toObject();
+    for (auto &&infoValR : byRoomIds) {
+        auto info = infoValR.toObject();
+        auto roomId = info["room_id"].toInteger();
+        auto shortId = info["short_id"].toInteger();
+        if (!rooms.contains(roomId) && shortId != 0 && rooms.contains(shortId)) {
+            roomId = shortId; // keep the id in settings
+        }
+
+        if (info["live_status"].toInt() != 1) {
+            continue;
+        }
+        auto title = QStringLiteral("【%1】%2").arg(info["uname"].toString(), info["title"].toString());
+        emit roomLive(roomId, title);
+    }
+}
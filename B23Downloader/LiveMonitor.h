@@ -0,0 +1,54 @@
+#ifndef LIVEMONITOR_H
+#define LIVEMONITOR_H
+
+#include <QObject>
+
+class QTimer;
+class QNetworkReply;
+
+/**
+ * @brief LiveMonitor polls live status of rooms listed in Settings and emits roomLive()
+ * for rooms that are live. Settings:
+ *   - monitor/rooms:    list of room ids (short ids are accepted)
+ *   - monitor/interval: seconds to poll every room once (default 60)
+ *   - monitor/apiBase:  base url of live API (default https://api.live.bilibili.com),
+ *                       can be pointed to a local mock server (in replay mode, ReplayServer serves
+ *                       room status itself, see ReplayServer)
+ *
+ * Rooms are polled in batches (getRoomBaseInfo accepts multiple room_ids) by a single timer.
+ * Batches are spread over the interval with jitter, so requests do not burst.
+ */
+class LiveMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int BatchSize = 20;
+
+    LiveMonitor(QObject *parent = nullptr);
+    ~LiveMonitor();
+
+    void reloadSettings();
+
+signals:
+    /**
+     * @brief emitted at every poll that finds the room live. whether it's being recorded is up to the
+     * receiver (a recording may have failed or been stopped meanwhile)
+     */
+    void roomLive(qint64 roomId, const QString &title);
+
+private:
+    QList<qint64> rooms;
+    QString apiBase;
+    int interval; // ms
+
+    int nextBatchIndex = 0;
+    QTimer *pollTimer;
+    QNetworkReply *httpReply = nullptr;
+
+    void scheduleNextPoll();
+    void poll();
+    void pollFinished();
+};
+
+#endif // LIVEMONITOR_H
@@ -9,6 +9,11 @@
 #include "TaskTable.h"
 #include "AboutWidget.h"
 #include "MyTabWidget.h"
+#include "LiveMonitor.h"
+#include "DownloadTask.h"
+#include "DownloadEngine.h"
+#include "NetworkStats.h"
+#include "ReplayServer.h"
 
 #include <QtWidgets>
 #include <QtNetwork>
@@ -16,7 +21,13 @@
 static constexpr int GetUserInfoRetryInterval = 10000; // ms
 static constexpr int GetUserInfoTimeout = 10000; // ms
 
-MainWindow::~MainWindow() = default;
+MainWindow::~MainWindow()
+{
+    // tasks are deleted (in download threads) with taskTable, before download threads are stopped
+    delete taskTable;
+    DownloadEngine::inst()->shutdown();
+    ReplayServer::stop();
+}
 
 
 MainWindow::MainWindow(QWidget *parent)
@@ -26,7 +37,9 @@ MainWindow::MainWindow(QWidget *parent)
     QApplication::setApplicationVersion(APP_VERSION);
 #endif
 
+    ReplayServer::startIfEnabled();
     Network::accessManager()->setCookieJar(Settings::inst()->getCookieJar());
+    Network::preconnect(QUrl("https://api.bilibili.com"));
     setWindowTitle("B23Downloader");
     setCentralWidget(new QWidget);
     auto mainLayout = new QVBoxLayout(centralWidget());
@@ -87,6 +100,8 @@ MainWindow::MainWindow(QWidget *parent)
 
     taskTable = new TaskTableWidget;
     QTimer::singleShot(0, this, [this]{ taskTable->load(); });
+    liveMonitor = new LiveMonitor(this);
+    connect(liveMonitor, &LiveMonitor::roomLive, this, &MainWindow::onRoomLive);
     auto tabs = new MyTabWidget;
     tabs->addTab(taskTable, QIcon(":/icons/download.svg"), "正在下载");
     tabs->addTab(new AboutWidget, QIcon(":/icons/about.svg"), "关于");
@@ -96,6 +111,17 @@ MainWindow::MainWindow(QWidget *parent)
     setMinimumSize(650, 360);
     QTimer::singleShot(0, this, [this]{ resize(minimumSize()); });
 
+    // debug: dump per-host network timings
+    auto dumpStatsShortcut = new QShortcut(QKeySequence("Ctrl+Alt+N"), this);
+    connect(dumpStatsShortcut, &QShortcut::activated, this, [this]{
+        auto path = NetworkStats::inst()->dump();
+        if (path.isNull()) {
+            QMessageBox::warning(this, "网络统计", "保存失败");
+        } else {
+            QMessageBox::information(this, "网络统计", "已保存到: " + QDir::toNativeSeparators(path));
+        }
+    });
+
     urlLineEdit->setFocus();
     startGetUserInfo();
     //    auto reply = B23Api::get("https://www.bilibili.com/blackboard/topic/activity-4AL5_Jqb3.html");
@@ -116,6 +142,19 @@ void MainWindow::closeEvent(QCloseEvent *event)
     }
 }
 
+void MainWindow::onRoomLive(qint64 roomId, const QString &title)
+{
+    if (taskTable->isRecording(roomId)) {
+        taskTable->restartFailedRecording(roomId);
+        return;
+    }
+    auto settings = Settings::inst();
+    auto dir = QDir(settings->value("monitor/dir", settings->value("lastDir")).toString());
+    auto qn = settings->value("monitor/qn", 10000).toInt();
+    auto path = dir.filePath(Utils::legalizedFileName(title));
+    taskTable->addTasks({ new LiveDownloadTask(roomId, qn, path) });
+}
+
 void MainWindow::startGetUserInfo()
 {
     if (!Settings::inst()->hasCookies()) {
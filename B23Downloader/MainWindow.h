@@ -11,6 +11,7 @@ class QNetworkReply;
 
 class ElidedTextLabel;
 class TaskTableWidget;
+class LiveMonitor;
 
 
 class MainWindow : public QMainWindow
@@ -34,6 +35,7 @@ private slots:
     void getUFaceFinished();
     void ufaceButtonClicked();
     void logoutActionTriggered();
+    void onRoomLive(qint64 roomId, const QString &title);
 
 private:
     bool hasGotUInfo = false;
@@ -45,5 +47,6 @@ private:
     ElidedTextLabel *unameLabel;
     QLineEdit *urlLineEdit;
     TaskTableWidget *taskTable;
+    LiveMonitor *liveMonitor;
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,208 @@
+#include "MetadataCache.h"
+#include "Network.h"
+#include "ReplayReply.h"
+#include "Settings.h"
+#include <QtNetwork>
+
+static const std::pair<const char*, int> Ttls[] = {
+    // longest matching path prefix wins
+    { "/pgc/view/web/season/user/status", 5 * 60 }, // paid or not
+    { "/pgc/view/web/season", 6 * 3600 },
+    { "/pgc/review/user", 24 * 3600 },
+    { "/pugv/view/web/season", 6 * 3600 },
+    { "/x/web-interface/view", 3600 },
+    { "/twirp/comic.v1.Comic/ComicDetail", 3600 },
+};
+
+static constexpr quint32 Magic = 0x4232334D; // "B23M"
+static constexpr quint8 Version = 1;
+
+Q_GLOBAL_STATIC(MetadataCache, metadataCache)
+
+MetadataCache *MetadataCache::inst()
+{
+    return metadataCache;
+}
+
+MetadataCache::MetadataCache()
+{
+    dir = QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("metadata");
+    isEnabled = Settings::inst()->value("cache/metadata", true).toBool();
+    if (isEnabled) {
+        QDir(dir).mkpath(".");
+        QThreadPool::globalInstance()->start([this]{ removeExpired(); });
+    }
+}
+
+int MetadataCache::ttlOf(const QUrl &url)
+{
+    auto path = url.path();
+    int ttl = 0;
+    qsizetype matchedLen = 0;
+    for (auto &[prefix, prefixTtl] : Ttls) {
+        qsizetype len = qstrlen(prefix);
+        if (path.startsWith(QLatin1String(prefix)) && len > matchedLen) {
+            ttl = prefixTtl;
+            matchedLen = len;
+        }
+    }
+    return ttl;
+}
+
+QString MetadataCache::pathOf(const QNetworkRequest &request, const QByteArray &body) const
+{
+    // responses differ between users (paid or not, VIP or not), and between logged in or not
+    auto uid = Settings::inst()->getCookieJar()->getCookie("DedeUserID");
+    auto key = request.url().toEncoded() + '\n' + body + '\n' + uid;
+    auto hash = QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex();
+    return QDir(dir).filePath(QString::fromLatin1(hash) + ".cache");
+}
+
+std::optional<MetadataCache::Entry> MetadataCache::load(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return std::nullopt;
+    }
+    QDataStream in(&file);
+    quint32 magic;
+    quint8 version;
+    in >> magic >> version;
+    if (magic != Magic || version != Version) {
+        return std::nullopt;
+    }
+    Entry entry;
+    in >> entry.time >> entry.etag >> entry.lastModified >> entry.contentType >> entry.content;
+    if (in.status() != QDataStream::Ok) {
+        return std::nullopt;
+    }
+    return entry;
+}
+
+void MetadataCache::store(const QString &path, const Entry &entry)
+{
+    // written off the GUI thread. season responses can be megabytes
+    QThreadPool::globalInstance()->start([path, entry]{
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly)) {
+            return;
+        }
+        QDataStream out(&file);
+        out << Magic << Version;
+        out << entry.time << entry.etag << entry.lastModified << entry.contentType << entry.content;
+        file.commit();
+    });
+}
+
+void MetadataCache::removeExpired()
+{
+    auto now = QDateTime::currentDateTime();
+    for (auto &fileInfo : QDir(dir).entryInfoList({"*.cache"}, QDir::Files)) {
+        if (fileInfo.lastModified().secsTo(now) > MaxAge) {
+            QFile::remove(fileInfo.absoluteFilePath());
+        }
+    }
+}
+
+static ReplayReply::Response responseOf(const QUrl &url, const QByteArray &contentType, const QByteArray &content)
+{
+    ReplayReply::Response ret;
+    ret.url = url;
+    ret.statusCode = 200;
+    ret.reasonPhrase = "OK";
+    ret.rawHeaders.append({ "Content-Type", contentType });
+    ret.content = content;
+    return ret;
+}
+
+static QByteArray headerOf(const ReplayReply::Response &response, const QByteArray &name)
+{
+    for (auto &[headerName, value] : response.rawHeaders) {
+        if (headerName.compare(name, Qt::CaseInsensitive) == 0) {
+            return value;
+        }
+    }
+    return QByteArray();
+}
+
+QNetworkReply *MetadataCache::send(const QNetworkRequest &request, const QByteArray &body, Transport transport, QObject *parent)
+{
+    auto url = request.url();
+    auto ttl = ttlOf(url);
+    if (!isEnabled || ttl == 0) {
+        return transport(request);
+    }
+
+    auto path = pathOf(request, body);
+    auto operation = (body.isNull() ? QNetworkAccessManager::GetOperation : QNetworkAccessManager::PostOperation);
+    auto reply = new ReplayReply(request, parent, operation);
+    // loaded off the calling (GUI) thread
+    auto promise = std::make_shared<QPromise<std::optional<Entry>>>();
+    auto future = promise->future();
+    promise->start();
+    QThreadPool::globalInstance()->start([promise, path]{
+        promise->addResult(load(path));
+        promise->finish();
+    });
+    // the continuation is cancelled if reply is destroyed
+    future.then(reply, [this, reply, request, path, transport](const std::optional<Entry> &entry) {
+        sendIfStale(reply, request, path, entry, transport);
+    });
+    return reply;
+}
+
+void MetadataCache::sendIfStale(ReplayReply *reply, const QNetworkRequest &request, const QString &path,
+                                const std::optional<Entry> &entry, const Transport &transport)
+{
+    if (reply->isFinished()) {
+        return; // aborted while loading
+    }
+    auto url = request.url();
+    if (entry && QDateTime::currentSecsSinceEpoch() - entry->time < ttlOf(url)) {
+        reply->finishWith(responseOf(url, entry->contentType, entry->content));
+        return;
+    }
+
+    auto sourceRequest = request;
+    if (entry && !entry->etag.isEmpty()) {
+        sourceRequest.setRawHeader("If-None-Match", entry->etag);
+    }
+    if (entry && !entry->lastModified.isEmpty()) {
+        sourceRequest.setRawHeader("If-Modified-Since", entry->lastModified);
+    }
+    auto source = transport(sourceRequest);
+
+    QObject::connect(source, &QNetworkReply::finished, reply, [this, reply, source, url, path, entry]{
+        auto response = ReplayReply::capture(source);
+        source->deleteLater();
+        auto status = response.statusCode.toInt();
+
+        if (entry && status == 304) {
+            auto revalidated = *entry;
+            revalidated.time = QDateTime::currentSecsSinceEpoch();
+            store(path, revalidated);
+            reply->finishWith(responseOf(url, entry->contentType, entry->content));
+            return;
+        }
+        if (response.error == QNetworkReply::NoError && status == 200 && Network::Bili::isSuccessContent(response.content)) {
+            store(path, {
+                QDateTime::currentSecsSinceEpoch(),
+                headerOf(response, "ETag"),
+                headerOf(response, "Last-Modified"),
+                headerOf(response, "Content-Type"),
+                response.content
+            });
+        } else if (entry && response.error != QNetworkReply::NoError && response.error != QNetworkReply::OperationCanceledError) {
+            // stale is better than nothing
+            reply->finishWith(responseOf(url, entry->contentType, entry->content));
+            return;
+        }
+        reply->finishWith(response);
+    });
+    // aborted or deleted by the receiver
+    QObject::connect(reply, &QNetworkReply::finished, source, [source]{ source->abort(); });
+    QObject::connect(reply, &QObject::destroyed, source, [source]{
+        source->abort();
+        source->deleteLater();
+    });
+}
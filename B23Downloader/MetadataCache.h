@@ -0,0 +1,67 @@
+#ifndef METADATACACHE_H
+#define METADATACACHE_H
+
+#include <QNetworkRequest>
+#include <functional>
+#include <optional>
+
+class QNetworkReply;
+class ReplayReply;
+
+/**
+ * @brief MetadataCache keeps responses of Extractor's metadata APIs (season, video, course and comic info)
+ * on disk, keyed by request (url and body) and the logged-in user. Each endpoint has its TTL:
+ *   - a fresh response is replayed without a request
+ *   - a stale one is revalidated with If-None-Match / If-Modified-Since when the server gave validators
+ *     (a 304 refreshes it), otherwise it's fetched again. it's still used if the request fails
+ * Only successful responses (HTTP 200 and code 0) are stored. Settings "cache/metadata" (default true)
+ * turns it off. Entries not refreshed for MaxAge are removed at startup.
+ * Entries are read and written off the calling (GUI) thread: season responses can be megabytes.
+ */
+class MetadataCache
+{
+public:
+    static constexpr qint64 MaxAge = 7 * 24 * 3600; // s
+
+    using Transport = std::function<QNetworkReply*(const QNetworkRequest &request)>;
+
+    static MetadataCache *inst();
+
+    MetadataCache();
+
+    /**
+     * @return cached reply if it's fresh, otherwise reply of transport (revalidated or stored when finished).
+     *         requests to endpoints that are not cached are sent with transport as they are
+     */
+    QNetworkReply *send(const QNetworkRequest &request, const QByteArray &body, Transport transport, QObject *parent);
+
+private:
+    struct Entry
+    {
+        qint64 time; // s since epoch, when it was fetched or revalidated
+        QByteArray etag;
+        QByteArray lastModified;
+        QByteArray contentType;
+        QByteArray content;
+    };
+
+    QString dir;
+    bool isEnabled;
+
+    /**
+     * @return TTL (s) of the endpoint of url, 0 if it's not cached
+     */
+    static int ttlOf(const QUrl &url);
+    QString pathOf(const QNetworkRequest &request, const QByteArray &body) const;
+    static std::optional<Entry> load(const QString &path);
+    void store(const QString &path, const Entry &entry);
+
+    /**
+     * @brief finishes reply with entry if it's fresh, otherwise sends the request (with validators of entry)
+     */
+    void sendIfStale(ReplayReply *reply, const QNetworkRequest &request, const QString &path,
+                     const std::optional<Entry> &entry, const Transport &transport);
+    void removeExpired();
+};
+
+#endif // METADATACACHE_H
@@ -0,0 +1,117 @@
+#include "MirrorProber.h"
+#include "Network.h"
+#include <QtNetwork>
+
+// the score is the estimated time to download ScoreReferenceBytesCnt bytes
+static constexpr qint64 ScoreReferenceBytesCnt = 8 * 1024 * 1024;
+
+MirrorProber::MirrorProber(const QList<QUrl> &mirrors, QObject *parent)
+    : QObject(parent)
+{
+    probes.reserve(mirrors.size());
+    for (auto &url : mirrors) {
+        probes.append(Probe{url});
+    }
+
+    timeoutTimer = new QTimer(this);
+    timeoutTimer->setSingleShot(true);
+    timeoutTimer->setInterval(ProbeTimeout);
+    connect(timeoutTimer, &QTimer::timeout, this, &MirrorProber::abort);
+}
+
+MirrorProber::~MirrorProber()
+{
+    for (auto &probe : probes) {
+        if (probe.reply != nullptr) {
+            probe.reply->disconnect(this);
+            probe.reply->abort();
+            probe.reply->deleteLater();
+        }
+    }
+}
+
+void MirrorProber::start()
+{
+    elapsedTimer.start();
+    timeoutTimer->start();
+    runningCnt = probes.size();
+    // the list is not modified after start, so references to its elements are stable
+    for (auto &probe : probes) {
+        auto request = Network::Bili::Request(probe.url);
+        request.setRawHeader("Range", "bytes=0-" + QByteArray::number(ProbeBytesCnt - 1));
+        probe.reply = Network::accessManager()->get(request);
+        connect(probe.reply, &QNetworkReply::readyRead, this, [this, &probe]{ onProbeReadyRead(probe); });
+        connect(probe.reply, &QNetworkReply::finished, this, [this, &probe]{ onProbeFinished(probe); });
+    }
+    if (runningCnt == 0) {
+        finish();
+    }
+}
+
+void MirrorProber::abort()
+{
+    for (auto &probe : probes) {
+        if (probe.reply != nullptr) {
+            probe.reply->abort();
+        }
+    }
+}
+
+void MirrorProber::onProbeReadyRead(Probe &probe)
+{
+    if (probe.ttfb == -1) {
+        probe.ttfb = elapsedTimer.elapsed();
+    }
+    probe.recvBytesCnt += probe.reply->skip(probe.reply->bytesAvailable());
+    if (probe.recvBytesCnt >= ProbeBytesCnt && probe.completeTime == -1) {
+        // the mirror may ignore Range and send the whole file
+        probe.completeTime = elapsedTimer.elapsed();
+        probe.reply->abort();
+    }
+}
+
+void MirrorProber::onProbeFinished(Probe &probe)
+{
+    auto reply = probe.reply;
+    probe.reply = nullptr;
+    reply->deleteLater();
+
+    auto statusCode = Network::statusCode(reply);
+    auto ok = (probe.completeTime != -1
+               || (reply->error() == QNetworkReply::NoError && (statusCode == 206 || statusCode == 200)));
+    if (ok && probe.ttfb != -1 && probe.recvBytesCnt > 0) {
+        auto endTime = (probe.completeTime != -1 ? probe.completeTime : elapsedTimer.elapsed());
+        auto transferTime = std::max<qint64>(endTime - probe.ttfb, 1);
+        auto bytesPerMSec = static_cast<double>(probe.recvBytesCnt) / transferTime;
+        probe.score = probe.ttfb + ScoreReferenceBytesCnt / bytesPerMSec;
+        qDebug() << "mirror probe:" << probe.url.host() << "ttfb" << probe.ttfb << "ms,"
+                 << qRound64(bytesPerMSec * 1000 / 1024) << "KB/s";
+    }
+
+    runningCnt--;
+    if (runningCnt == 0) {
+        finish();
+    }
+}
+
+void MirrorProber::finish()
+{
+    timeoutTimer->stop();
+
+    QList<Probe*> ranked;
+    for (auto &probe : probes) {
+        ranked.append(&probe);
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [](Probe *a, Probe *b) {
+        if (a->score < 0 || b->score < 0) {
+            return b->score < 0 && a->score >= 0;
+        }
+        return a->score < b->score;
+    });
+
+    QList<QUrl> urls;
+    for (auto probe : ranked) {
+        urls.append(probe->url);
+    }
+    emit finished(urls);
+}
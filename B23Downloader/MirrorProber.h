@@ -0,0 +1,55 @@
+#ifndef MIRRORPROBER_H
+#define MIRRORPROBER_H
+
+#include <QObject>
+#include <QUrl>
+#include <QElapsedTimer>
+
+class QNetworkReply;
+class QTimer;
+
+/**
+ * @brief MirrorProber requests the first ProbeBytesCnt bytes from each CDN mirror of the same file,
+ * measures time to first byte and throughput, and ranks mirrors by estimated time of downloading.
+ * A mirror that ignores Range is measured with the first ProbeBytesCnt bytes of its response.
+ * Mirrors that fail or time out are ranked last (in original order).
+ */
+class MirrorProber : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr qint64 ProbeBytesCnt = 256 * 1024;
+    static constexpr int ProbeTimeout = 5000; // ms
+
+    MirrorProber(const QList<QUrl> &mirrors, QObject *parent = nullptr);
+    ~MirrorProber();
+
+    void start();
+    void abort();
+
+signals:
+    void finished(const QList<QUrl> &rankedMirrors);
+
+private:
+    struct Probe
+    {
+        QUrl url;
+        QNetworkReply *reply = nullptr;
+        qint64 ttfb = -1;    // ms
+        qint64 recvBytesCnt = 0;
+        qint64 completeTime = -1; // ms, when ProbeBytesCnt bytes were received (the rest is aborted)
+        double score = -1;   // estimated ms, smaller is better. -1 if failed
+    };
+
+    QList<Probe> probes;
+    int runningCnt = 0;
+    QElapsedTimer elapsedTimer;
+    QTimer *timeoutTimer;
+
+    void onProbeReadyRead(Probe &probe);
+    void onProbeFinished(Probe &probe);
+    void finish();
+};
+
+#endif // MIRRORPROBER_H
@@ -1,14 +1,310 @@
 #include "Network.h"
+#include "Settings.h"
+#include "ReplayReply.h"
+#include "RetryPolicy.h"
+#include "NetworkStats.h"
+#include "ReplayServer.h"
+#include "ApiRateLimiter.h"
+#include "MetadataCache.h"
 #include <QtNetwork>
 
 namespace Network
 {
 
-Q_GLOBAL_STATIC(QNetworkAccessManager, nam)
+// shorter than keep-alive timeout of most servers
+static constexpr int KeepWarmInterval = 45 * 1000; // ms
+// connections to hosts not requested for this long are not kept warm
+static constexpr int KeepWarmDuration = 5 * 60 * 1000; // ms
+static constexpr int ConnectionCacheExpiry = 5 * 60; // s
+
+// successful results of coalesced requests are reused for this long
+static constexpr int CoalescedResultTtl = 3000; // ms
+
+// default windows (64K) limit throughput of a stream to window / RTT
+static constexpr unsigned Http2StreamWindowSize = 8 * 1024 * 1024;
+static constexpr unsigned Http2SessionWindowSize = 32 * 1024 * 1024;
+
+// replies larger than this are parsed in a worker thread by parseReplyAsync()
+static constexpr qsizetype AsyncParseThreshold = 64 * 1024; // bytes
+
+/**
+ * @brief read from Settings:
+ *   - network/http2: whether HTTP/2 is used where the server supports it (default true)
+ *   - network/connectionsPerHost: list of "host=count", connection limit of HTTP/1 hosts (Qt 6.5 and later)
+ */
+struct ConnectionPolicy
+{
+    bool http2 = true;
+    QHash<QString, int> connectionsPerHost;
+};
+
+static const ConnectionPolicy &connectionPolicy()
+{
+    // read on first request, which is in GUI thread
+    static const ConnectionPolicy policy = []{
+        ConnectionPolicy ret;
+        auto settings = Settings::inst();
+        ret.http2 = settings->value("network/http2", true).toBool();
+        for (auto &item : settings->value("network/connectionsPerHost").toStringList()) {
+            auto hostAndCnt = item.split('=');
+            bool ok;
+            auto cnt = hostAndCnt.value(1).trimmed().toInt(&ok);
+            if (hostAndCnt.size() == 2 && ok && cnt > 0) {
+                ret.connectionsPerHost.insert(hostAndCnt[0].trimmed().toLower(), cnt);
+            }
+        }
+        return ret;
+    }();
+    return policy;
+}
+
+/**
+ * @brief transport of every request (including those of Extractor, LoginDialog...): sends it to
+ * ReplayServer in replay mode, and applies ConnectionPolicy to it.
+ * It keeps connections to recently requested hosts warm, so that the next API call skips handshakes.
+ * Identical GET requests can be coalesced (see getCoalesced()).
+ */
+class AccessManager : public QNetworkAccessManager
+{
+public:
+    AccessManager()
+    {
+        elapsedTimer.start();
+        keepWarmTimer = new QTimer(this);
+        keepWarmTimer->setInterval(KeepWarmInterval);
+        connect(keepWarmTimer, &QTimer::timeout, this, &AccessManager::keepWarm);
+    }
+
+    void preconnect(const QUrl &url)
+    {
+        auto target = (ReplayServer::isReplaying() ? ReplayServer::localUrl(url) : url);
+        markUsed(target);
+        connectTo(originOf(target));
+    }
+
+    /**
+     * @brief a request identical (same url) to one in flight is not sent, but gets the result of it.
+     * a successful result is reused for CoalescedResultTtl ms. each requester gets its own ReplayReply
+     */
+    QNetworkReply *getCoalesced(const QNetworkRequest &request)
+    {
+        // conditional requests (of MetadataCache) can get 304
+        auto key = request.url().toString(QUrl::FullyEncoded)
+                + request.rawHeader("If-None-Match") + request.rawHeader("If-Modified-Since");
+        auto reply = new ReplayReply(request, this);
+
+        removeStaleResults();
+        auto resultIt = results.constFind(key);
+        if (resultIt != results.constEnd()) {
+            reply->finishWith(resultIt->first);
+            return reply;
+        }
+
+        auto it = inFlights.find(key);
+        if (it == inFlights.end()) {
+            auto source = RetryPolicy::inst()->send(request, false, [this, request]{ return get(request); }, this);
+            connect(source, &QNetworkReply::finished, this, [this, key]{ onCoalescedSourceFinished(key); });
+            it = inFlights.insert(key, {source, {}});
+        }
+        it->waiters.append(reply);
+        connect(reply, &QNetworkReply::finished, this, [this, key]{ abortIfNoWaiter(key); });
+        return reply;
+    }
+
+protected:
+    QNetworkReply *createRequest(Operation op, const QNetworkRequest &originalRequest, QIODevice *outgoingData) override
+    {
+        QNetworkRequest request(originalRequest);
+        // connectToHostEncrypted() sends a request of scheme "preconnect-https"
+        auto isPreconnect = request.url().scheme().startsWith("preconnect");
+        if (!isPreconnect && ReplayServer::isReplaying()) {
+            request.setUrl(ReplayServer::localUrl(request.url()));
+        }
+        applyPolicy(request);
+        QByteArray body;
+        if (!isPreconnect && ReplayServer::isRecording() && outgoingData != nullptr && !outgoingData->isSequential()) {
+            body = outgoingData->peek(outgoingData->size());
+        }
+
+        auto reply = QNetworkAccessManager::createRequest(op, request, outgoingData);
+        if (!isPreconnect) {
+            markUsed(request.url());
+            NetworkStats::inst()->track(reply);
+            if (ReplayServer::isRecording()) {
+                ReplayServer::record(reply, body);
+            }
+        }
+        return reply;
+    }
+
+private:
+    QElapsedTimer elapsedTimer;
+    QTimer *keepWarmTimer;
+    QHash<QUrl, qint64> lastUsedTime; // of origins
+
+    struct InFlight
+    {
+        QNetworkReply *source;
+        QList<QPointer<ReplayReply>> waiters;
+    };
+    QHash<QString, InFlight> inFlights;
+    QHash<QString, std::pair<ReplayReply::Response, qint64>> results; // (response, time)
+
+    void onCoalescedSourceFinished(const QString &key)
+    {
+        auto inFlight = inFlights.take(key);
+        auto response = ReplayReply::capture(inFlight.source);
+        inFlight.source->deleteLater();
+        // errors like -412 (throttled) or -101 (not logged in) would be stale to later waiters
+        if (response.error == QNetworkReply::NoError && response.statusCode.toInt() == 200
+                && Bili::isSuccessContent(response.content)) {
+            results.insert(key, {response, elapsedTimer.elapsed()});
+        }
+        for (auto &waiter : inFlight.waiters) {
+            if (waiter != nullptr) {
+                waiter->finishWith(response);
+            }
+        }
+    }
+
+    void abortIfNoWaiter(const QString &key)
+    {
+        // called when a waiter is finished. it's aborted if the request is still in flight
+        auto it = inFlights.find(key);
+        if (it == inFlights.end()) {
+            return;
+        }
+        for (auto &waiter : it->waiters) {
+            if (waiter != nullptr && !waiter->isFinished()) {
+                return;
+            }
+        }
+        auto source = it->source;
+        inFlights.erase(it);
+        source->disconnect(this);
+        source->abort();
+        source->deleteLater();
+    }
+
+    void removeStaleResults()
+    {
+        auto now = elapsedTimer.elapsed();
+        for (auto it = results.begin(); it != results.end(); ) {
+            if (now - it->second > CoalescedResultTtl) {
+                it = results.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    static QUrl originOf(const QUrl &url)
+    {
+        return url.adjusted(QUrl::RemoveUserInfo | QUrl::RemovePath | QUrl::RemoveQuery | QUrl::RemoveFragment);
+    }
+
+    static void applyPolicy(QNetworkRequest &request)
+    {
+        auto &policy = connectionPolicy();
+        request.setAttribute(QNetworkRequest::Http2AllowedAttribute, policy.http2);
+        if (policy.http2) {
+            auto http2Config = request.http2Configuration();
+            http2Config.setStreamReceiveWindowSize(Http2StreamWindowSize);
+            http2Config.setSessionReceiveWindowSize(Http2SessionWindowSize);
+            request.setHttp2Configuration(http2Config);
+        }
+#if QT_VERSION >= QT_VERSION_CHECK(6, 3, 0)
+        request.setAttribute(QNetworkRequest::ConnectionCacheExpiryTimeoutSecondsAttribute, ConnectionCacheExpiry);
+#endif
+#if QT_VERSION >= QT_VERSION_CHECK(6, 5, 0)
+        auto cnt = policy.connectionsPerHost.value(request.url().host().toLower());
+        if (cnt > 0) {
+            QHttp1Configuration http1Config;
+            http1Config.setNumberOfConnectionsPerHost(cnt);
+            request.setHttp1Configuration(http1Config);
+        }
+#endif
+    }
+
+    void markUsed(const QUrl &url)
+    {
+        lastUsedTime.insert(originOf(url), elapsedTimer.elapsed());
+        if (!keepWarmTimer->isActive()) {
+            keepWarmTimer->start();
+        }
+    }
+
+    void connectTo(const QUrl &origin)
+    {
+        if (origin.scheme() == "https") {
+            auto sslConfig = QSslConfiguration::defaultConfiguration();
+            if (connectionPolicy().http2) {
+                sslConfig.setAllowedNextProtocols({QSslConfiguration::ALPNProtocolHTTP2,
+                                                   QSslConfiguration::NextProtocolHttp1_1});
+            }
+            connectToHostEncrypted(origin.host(), static_cast<quint16>(origin.port(443)), sslConfig);
+        } else {
+            connectToHost(origin.host(), static_cast<quint16>(origin.port(80)));
+        }
+    }
+
+    void keepWarm()
+    {
+        // a cached connection that is still open is reused by connectToHost*(), otherwise a new one is made
+        auto now = elapsedTimer.elapsed();
+        for (auto it = lastUsedTime.begin(); it != lastUsedTime.end(); ) {
+            if (now - it.value() > KeepWarmDuration) {
+                it = lastUsedTime.erase(it);
+            } else {
+                connectTo(it.key());
+                it++;
+            }
+        }
+        if (lastUsedTime.isEmpty()) {
+            keepWarmTimer->stop();
+        }
+    }
+};
+
+Q_GLOBAL_STATIC(AccessManager, nam)
+
+/**
+ * @brief cookie jar of managers of download threads. cookies are kept in the jar of GUI thread's manager
+ */
+class SharedCookieJar : public QNetworkCookieJar
+{
+public:
+    QList<QNetworkCookie> cookiesForUrl(const QUrl &url) const override
+    {
+        return nam->cookieJar()->cookiesForUrl(url);
+    }
+
+    bool setCookiesFromUrl(const QList<QNetworkCookie> &cookieList, const QUrl &url) override
+    {
+        return nam->cookieJar()->setCookiesFromUrl(cookieList, url);
+    }
+};
+
+// deleted when the thread finishes
+static QThreadStorage<AccessManager*> threadNams;
 
 QNetworkAccessManager *accessManager()
 {
-    return nam();
+    // a manager can only be used in the thread it lives in
+    if (QThread::currentThread() == QCoreApplication::instance()->thread()) {
+        return nam();
+    }
+    if (!threadNams.hasLocalData()) {
+        auto threadNam = new AccessManager;
+        threadNam->setCookieJar(new SharedCookieJar);
+        threadNams.setLocalData(threadNam);
+    }
+    return threadNams.localData();
+}
+
+void preconnect(const QUrl &url)
+{
+    static_cast<AccessManager*>(accessManager())->preconnect(url);
 }
 
 int statusCode(QNetworkReply *reply)
@@ -16,6 +312,13 @@ int statusCode(QNetworkReply *reply)
     return reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 }
 
+bool isPartialContent(QNetworkReply *reply, qint64 begin, qint64 end)
+{
+    // Content-Range: bytes <first>-<last>/<total or *>
+    auto range = QByteArray::number(begin) + "-" + QByteArray::number(end - 1) + "/";
+    return statusCode(reply) == 206 && reply->rawHeader("Content-Range").trimmed().startsWith("bytes " + range);
+}
+
 
 
 const QByteArray Bili::Referer("https://www.bilibili.com");
@@ -32,33 +335,54 @@ Bili::Request::Request(const QUrl &url)
 
 QNetworkReply *Bili::get(const QUrl &url)
 {
-    return nam->get(Bili::Request(url));
+    // API requests are coalesced. content of other hosts (CDN) may be large and read as a stream
+    auto manager = static_cast<AccessManager*>(accessManager());
+    if (url.host().startsWith("api.")) {
+        auto transport = [manager](const QNetworkRequest &request) { return manager->getCoalesced(request); };
+        return MetadataCache::inst()->send(Bili::Request(url), QByteArray(), transport, manager);
+    }
+    return manager->get(Bili::Request(url));
 }
 
 QNetworkReply *Bili::get(const QString &url)
 {
-    return nam->get(Bili::Request(url));
+    return get(QUrl(url));
+}
+
+bool Bili::isSuccessContent(const QByteArray &content)
+{
+    // Bili API responses begin with the code. saves parsing of large ones
+    static const QRegularExpression successRegex(R"(^\s*\{\s*"code"\s*:\s*0\s*[,}])");
+    return successRegex.match(QString::fromUtf8(content.left(64))).hasMatch();
+}
+
+static QNetworkReply *postWithRetry(const QNetworkRequest &request, const QByteArray &data)
+{
+    auto manager = accessManager();
+    auto transport = [manager, data](const QNetworkRequest &request) {
+        auto send = [manager, request, data]{ return manager->post(request, data); };
+        return RetryPolicy::inst()->send(request, true, send, manager);
+    };
+    return MetadataCache::inst()->send(request, data, transport, manager);
 }
 
 QNetworkReply *Bili::postUrlEncoded(const QString &url, const QByteArray &data)
 {
     auto request = Bili::Request(url);
     request.setRawHeader("content-type", "application/x-www-form-urlencoded;charset=UTF-8");
-    return nam->post(request, data);
+    return postWithRetry(request, data);
 }
 
 QNetworkReply *Bili::postJson(const QString &url, const QByteArray &data)
 {
     auto request = Bili::Request(url);
     request.setRawHeader("content-type", "application/json;charset=UTF-8");
-    return nam->post(request, data);
+    return postWithRetry(request, data);
 }
 
 QNetworkReply *Bili::postJson(const QString &url, const QJsonObject &obj)
 {
-    auto request = Bili::Request(url);
-    request.setRawHeader("content-type", "application/json;charset=UTF-8");
-    return nam->post(request, QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    return postJson(url, QJsonDocument(obj).toJson(QJsonDocument::Compact));
 }
 
 static bool isJsonValueInvalid(const QJsonValue &val)
@@ -66,25 +390,144 @@ static bool isJsonValueInvalid(const QJsonValue &val)
     return val.isNull() || val.isUndefined();
 }
 
-std::pair<QJsonObject, QString> Bili::parseReply(QNetworkReply *reply, const QString& requiredKey)
+/**
+ * @return error string of a reply that is not a JSON response, or null string
+ */
+static QString checkReply(QNetworkReply *reply)
 {
     if (reply->error() != QNetworkReply::NoError) {
         qDebug() << "network error:" << reply->errorString() << ", url=" << reply->url().toString();
-        return { QJsonObject(), "网络请求错误" };
+        return "网络请求错误";
     }
     if (!reply->header(QNetworkRequest::ContentTypeHeader).toString().contains("json")) {
-        return { QJsonObject(), "http请求错误" };
+        return "http请求错误";
     }
-    auto data = reply->readAll();
-    auto jsonDoc = QJsonDocument::fromJson(data);
-    auto jsonObj = jsonDoc.object();
-    qDebug() << "reply from" << reply->url(); // << QString::fromUtf8(data);
+    return QString();
+}
+
+/**
+ * @return end (exclusive) of the JSON value that begins at pos, or -1 if it's malformed.
+ * a scalar value ends at the next ',' or '}' (trailing spaces included)
+ */
+static qsizetype skipJsonValue(const QByteArray &data, qsizetype pos)
+{
+    int depth = 0;
+    bool inString = false;
+    for (auto i = pos; i < data.size(); i++) {
+        auto c = data[i];
+        if (inString) {
+            if (c == '\\') {
+                i++;
+            } else if (c == '"') {
+                inString = false;
+                if (depth == 0) {
+                    return i + 1;
+                }
+            }
+            continue;
+        }
+        switch (c) {
+        case '"':
+            inString = true;
+            break;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            if (depth == 0) {
+                return i;
+            }
+            if (--depth == 0) {
+                return i + 1;
+            }
+            break;
+        case ',':
+            if (depth == 0) {
+                return i;
+            }
+            break;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief parses only the given top-level members of a JSON object: values of other members are
+ * skipped without building their DOM.
+ * @return empty object if the document is malformed
+ */
+static QJsonObject parseJsonMembers(const QByteArray &data, const QStringList &keys)
+{
+    auto skipSpaces = [&data](qsizetype i) {
+        while (i < data.size() && QChar::isSpace(uchar(data[i]))) {
+            i++;
+        }
+        return i;
+    };
+
+    QJsonObject obj;
+    auto i = skipSpaces(0);
+    if (i >= data.size() || data[i] != '{') {
+        return QJsonObject();
+    }
+    i = skipSpaces(i + 1);
+    while (i < data.size() && data[i] != '}') {
+        // keys of Bili API responses contain no escape sequences
+        auto keyEnd = skipJsonValue(data, i);
+        if (data[i] != '"' || keyEnd < 0) {
+            return QJsonObject();
+        }
+        auto key = QString::fromUtf8(data.mid(i + 1, keyEnd - i - 2));
+        i = skipSpaces(keyEnd);
+        if (i >= data.size() || data[i] != ':') {
+            return QJsonObject();
+        }
+        auto valueBegin = skipSpaces(i + 1);
+        auto valueEnd = skipJsonValue(data, valueBegin);
+        if (valueEnd < 0) {
+            return QJsonObject();
+        }
+        if (keys.contains(key)) {
+            auto arr = QJsonDocument::fromJson('[' + data.mid(valueBegin, valueEnd - valueBegin) + ']').array();
+            if (arr.size() != 1) {
+                return QJsonObject();
+            }
+            obj.insert(key, arr.first());
+        }
+        i = skipSpaces(valueEnd);
+        if (i < data.size() && data[i] == ',') {
+            i = skipSpaces(i + 1);
+        }
+    }
+    return obj;
+}
+
+/**
+ * @param membersOnly if true (and requiredKey is not empty), members other than
+ *        requiredKey and those checked here (code, message, msg) are not parsed
+ */
+static std::pair<QJsonObject, QString> parseJsonData(
+        const QByteArray &data, const QString &requiredKey, const QUrl &url, bool membersOnly)
+{
+    QJsonObject jsonObj;
+    if (membersOnly && !requiredKey.isEmpty()) {
+        jsonObj = parseJsonMembers(data, { "code", "message", "msg", requiredKey });
+    } else {
+        jsonObj = QJsonDocument::fromJson(data).object();
+    }
+    qDebug() << "reply from" << url; // << QString::fromUtf8(data);
 
     if (jsonObj.isEmpty()) {
         return { QJsonObject(), "http请求错误" };
     }
 
     int code = jsonObj["code"].toInt(0);
+    if (ApiRateLimiter::isThrottleCode(code)) {
+        // also seen by RetryPolicy if the reply came through it. reported once per ThrottleWindow
+        ApiRateLimiter::inst()->onThrottled(url);
+    }
     if (code < 0 || (!requiredKey.isEmpty() && isJsonValueInvalid(jsonObj[requiredKey]))) {
         if (jsonObj.contains("message")) {
             return { jsonObj, jsonObj["message"].toString() };
@@ -93,12 +536,50 @@ std::pair<QJsonObject, QString> Bili::parseReply(QNetworkReply *reply, const QSt
             return { jsonObj, jsonObj["msg"].toString() };
         }
         auto format = QStringLiteral("B站请求错误: code = %1, requiredKey = %2\nURL: %3");
-        auto msg = format.arg(QString::number(code), requiredKey, reply->url().toString());
+        auto msg = format.arg(QString::number(code), requiredKey, url.toString());
         return { jsonObj, msg };
     }
 
     return { jsonObj, QString() };
 }
 
+std::pair<QJsonObject, QString> Bili::parseReply(QNetworkReply *reply, const QString& requiredKey)
+{
+    auto errorString = checkReply(reply);
+    if (!errorString.isNull()) {
+        return { QJsonObject(), errorString };
+    }
+    return parseJsonData(reply->readAll(), requiredKey, reply->url(), false);
+}
+
+void Bili::parseReplyAsync(QNetworkReply *reply, const QString &requiredKey, QObject *context, ParseCallback callback)
+{
+    auto errorString = checkReply(reply);
+    auto data = (errorString.isNull() ? reply->readAll() : QByteArray());
+    auto url = reply->url();
+
+    if (!errorString.isNull() || data.size() < AsyncParseThreshold) {
+        auto result = (errorString.isNull() ? parseJsonData(data, requiredKey, url, false)
+                                            : std::pair(QJsonObject(), errorString));
+        QMetaObject::invokeMethod(context, [callback, result]{
+            callback(result.first, result.second);
+        }, Qt::QueuedConnection);
+        return;
+    }
+
+    using Result = std::pair<QJsonObject, QString>;
+    auto promise = std::make_shared<QPromise<Result>>();
+    auto future = promise->future();
+    promise->start();
+    QThreadPool::globalInstance()->start([promise, data, requiredKey, url] {
+        promise->addResult(parseJsonData(data, requiredKey, url, true));
+        promise->finish();
+    });
+    // the continuation is cancelled if context is destroyed
+    future.then(context, [callback](const Result &result) {
+        callback(result.first, result.second);
+    });
+}
+
 
 } // namespace Network
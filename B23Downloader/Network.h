@@ -6,14 +6,31 @@
 #include <QJsonObject>
 
 #include <tuple>
+#include <functional>
 
 namespace Network
 {
 
+/**
+ * @return manager of current thread. download threads (see DownloadEngine) have their own managers,
+ * which share cookies with the manager of GUI thread
+ */
 QNetworkAccessManager *accessManager();
 
+/**
+ * @brief connect to host of url in advance (DNS lookup, TCP and TLS handshakes) with the manager of current thread.
+ * connections to hosts requested in the last few minutes are kept warm
+ */
+void preconnect(const QUrl &url);
+
 int statusCode(QNetworkReply *reply);
 
+/**
+ * @return true if reply is 206 Partial Content with Content-Range [begin, end).
+ * servers may ignore Range (200 with whole body) or send an error page instead
+ */
+bool isPartialContent(QNetworkReply *reply, qint64 begin, qint64 end);
+
 
 namespace Bili {
 
@@ -30,9 +47,18 @@ public:
 };
 
 
+/**
+ * @brief GET requests to API hosts (api.*) are coalesced: a request identical to one in flight
+ * gets the result of it, and a successful result is reused for a few seconds
+ */
 QNetworkReply *get(const QString &url);
 QNetworkReply *get(const QUrl &url);
 
+/*
+ * API requests (GET to api.* hosts and POSTs) are sent through RetryPolicy,
+ * which retries failed ones with backoff and stops requesting a host that rate-limits
+ */
+
 /**
  * @brief post data to url with content-type header set to application/x-www-form-urlencoded
  */
@@ -53,6 +79,21 @@ QNetworkReply *postJson(const QString &url, const QJsonObject &obj);
  * @param requiredKey is only used to help checking whether request is succeed.
  */
 std::pair<QJsonObject, QString> parseReply(QNetworkReply *reply, const QString& requiredKey = QString());
+
+using ParseCallback = std::function<void(const QJsonObject &json, const QString &errorString)>;
+
+/**
+ * @brief like parseReply(), but the result is delivered to callback in thread of context (queued,
+ * and dropped if context is destroyed). large replies are parsed in a worker thread, and only members
+ * "code", "message", "msg" and requiredKey (if not empty) of them are parsed.
+ * the reply can be deleted once this returns
+ */
+void parseReplyAsync(QNetworkReply *reply, const QString &requiredKey, QObject *context, ParseCallback callback);
+
+/**
+ * @return whether content is an API response with code 0. only its beginning is checked
+ */
+bool isSuccessContent(const QByteArray &content);
 } // end namespace Bili
 
 
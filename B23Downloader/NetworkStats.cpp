@@ -0,0 +1,148 @@
+#include "NetworkStats.h"
+#include "Settings.h"
+#include <QtNetwork>
+
+static constexpr const char *PhaseNames[] = { "queued", "connect", "send", "ttfb", "transfer" };
+
+Q_GLOBAL_STATIC(NetworkStats, networkStats)
+
+NetworkStats *NetworkStats::inst()
+{
+    return networkStats;
+}
+
+NetworkStats::NetworkStats() = default;
+
+void NetworkStats::Histogram::add(qint64 ms)
+{
+    int i = 0;
+    while (i < BucketCnt - 1 && (qint64(1) << i) <= ms) {
+        i++;
+    }
+    buckets[i]++;
+    cnt++;
+    sum += ms;
+    max = std::max(max, ms);
+}
+
+QJsonObject NetworkStats::Histogram::toJson() const
+{
+    QJsonArray bucketsArr;
+    for (auto n : buckets) {
+        bucketsArr.append(n);
+    }
+    return QJsonObject{
+        { "count", cnt },
+        { "avg", (cnt == 0 ? 0.0 : double(sum) / cnt) },
+        { "max", max },
+        { "buckets", bucketsArr }
+    };
+}
+
+void NetworkStats::addTiming(const QString &host, Phase phase, qint64 ms)
+{
+    QMutexLocker locker(&mutex);
+    hosts[host].phases[phase].add(ms);
+}
+
+void NetworkStats::track(QNetworkReply *reply)
+{
+    struct Timing
+    {
+        QElapsedTimer timer;
+        qint64 lastMark = 0;
+        bool isConnecting = false;
+        bool hasMetaData = false;
+        qint64 receivedBytes = 0;
+
+        qint64 mark()
+        {
+            auto now = timer.elapsed();
+            return now - std::exchange(lastMark, now);
+        }
+    };
+
+    auto host = reply->url().host();
+    auto timing = std::make_shared<Timing>();
+    timing->timer.start();
+    {
+        QMutexLocker locker(&mutex);
+        hosts[host].requestCnt++;
+    }
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 3, 0)
+    QObject::connect(reply, &QNetworkReply::socketStartedConnecting, reply, [=]{
+        addTiming(host, Queued, timing->mark());
+        timing->isConnecting = true;
+    });
+    QObject::connect(reply, &QNetworkReply::requestSent, reply, [=]{
+        // for plain HTTP, connect is measured until the request is sent
+        auto phase = (std::exchange(timing->isConnecting, false) ? Connect : Send);
+        addTiming(host, phase, timing->mark());
+    });
+#endif
+    QObject::connect(reply, &QNetworkReply::encrypted, reply, [=]{
+        if (std::exchange(timing->isConnecting, false)) {
+            addTiming(host, Connect, timing->mark());
+        }
+    });
+    QObject::connect(reply, &QNetworkReply::metaDataChanged, reply, [=]{
+        if (!std::exchange(timing->hasMetaData, true)) {
+            addTiming(host, Ttfb, timing->mark());
+        }
+    });
+    QObject::connect(reply, &QNetworkReply::downloadProgress, reply, [=](qint64 bytesReceived) {
+        timing->receivedBytes = bytesReceived;
+    });
+    QObject::connect(reply, &QNetworkReply::finished, reply, [=]{
+        auto error = reply->error();
+        if (error == QNetworkReply::OperationCanceledError) {
+            return; // aborted, or timed out by transfer timeout
+        }
+        QMutexLocker locker(&mutex);
+        auto &stats = hosts[host];
+        if (error != QNetworkReply::NoError) {
+            stats.errorCnt++;
+            return;
+        }
+        stats.phases[Transfer].add(timing->mark());
+        stats.transferredBytes += timing->receivedBytes;
+    });
+}
+
+QJsonObject NetworkStats::toJson()
+{
+    QMutexLocker locker(&mutex);
+    QJsonObject ret;
+    for (auto it = hosts.cbegin(); it != hosts.cend(); ++it) {
+        auto &stats = it.value();
+        QJsonObject hostObj {
+            { "requests", stats.requestCnt },
+            { "errors", stats.errorCnt },
+            { "transferredBytes", stats.transferredBytes }
+        };
+        auto transferTime = stats.phases[Transfer].sum;
+        if (transferTime > 0) {
+            hostObj.insert("throughput", stats.transferredBytes * 1000 / transferTime); // bytes/s
+        }
+        for (int i = 0; i < PhaseCnt; i++) {
+            hostObj.insert(PhaseNames[i], stats.phases[i].toJson());
+        }
+        ret.insert(it.key(), hostObj);
+    }
+    return ret;
+}
+
+QString NetworkStats::dump()
+{
+    auto dir = QFileInfo(Settings::inst()->fileName()).dir();
+    auto path = dir.filePath("network-stats.json");
+    QFile file(path);
+    auto data = QJsonDocument(toJson()).toJson();
+    if (!dir.mkpath(".") || !file.open(QIODevice::WriteOnly) || file.write(data) != data.size()) {
+        qWarning() << "failed to dump network stats to" << path;
+        return QString();
+    }
+    qInfo() << "network stats dumped to" << path;
+    return path;
+}
@@ -0,0 +1,73 @@
+#ifndef NETWORKSTATS_H
+#define NETWORKSTATS_H
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QMutex>
+#include <QHash>
+#include <array>
+
+class QNetworkReply;
+
+/**
+ * @brief NetworkStats collects phase timings of every request sent by Network::accessManager()
+ * (API requests and CDN downloads), and aggregates them into per-host histograms.
+ * Phases (ms), each measured from the end of the previous one:
+ *   - queued: until the request starts connecting (only if a new connection is made)
+ *   - connect: DNS lookup, TCP and TLS handshakes (Qt reports no finer steps)
+ *   - send: until the request is sent
+ *   - ttfb: until response headers are received (server think time)
+ *   - transfer: until the body is received (only for successful requests)
+ * Connecting phases need Qt 6.3 or later.
+ */
+class NetworkStats
+{
+public:
+    static constexpr int BucketCnt = 20; // bucket i: [2^(i-1), 2^i) ms, bucket 0: [0, 1) ms
+
+    enum Phase { Queued, Connect, Send, Ttfb, Transfer, PhaseCnt };
+
+    static NetworkStats *inst();
+
+    NetworkStats();
+
+    /**
+     * @brief start timing reply. called when it's created (in its thread)
+     */
+    void track(QNetworkReply *reply);
+
+    QJsonObject toJson();
+
+    /**
+     * @brief writes toJson() to "network-stats.json" in the directory of settings file
+     * @return path of the file, or null string if failed
+     */
+    QString dump();
+
+private:
+    struct Histogram
+    {
+        std::array<qint64, BucketCnt> buckets = {};
+        qint64 cnt = 0;
+        qint64 sum = 0;
+        qint64 max = 0;
+
+        void add(qint64 ms);
+        QJsonObject toJson() const;
+    };
+
+    struct HostStats
+    {
+        std::array<Histogram, PhaseCnt> phases;
+        qint64 requestCnt = 0;
+        qint64 errorCnt = 0;
+        qint64 transferredBytes = 0;
+    };
+
+    QMutex mutex;
+    QHash<QString, HostStats> hosts;
+
+    void addTiming(const QString &host, Phase phase, qint64 ms);
+};
+
+#endif // NETWORKSTATS_H
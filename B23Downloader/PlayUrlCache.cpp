@@ -0,0 +1,94 @@
+#include "PlayUrlCache.h"
+#include <QDateTime>
+#include <QJsonArray>
+#include <QUrlQuery>
+
+// used if no url has deadline param
+static constexpr qint64 DefaultTtl = 10 * 60 * 1000; // ms
+
+// an entry expiring within this time is not used, as the download would fail soon
+static constexpr qint64 ExpiryMargin = 60 * 1000; // ms
+
+Q_GLOBAL_STATIC(PlayUrlCache, playUrlCache)
+
+PlayUrlCache *PlayUrlCache::inst()
+{
+    return playUrlCache();
+}
+
+static qint64 urlExpiry(const QString &url)
+{
+    QUrlQuery query(QUrl(url).query());
+    for (auto key : {"deadline", "expires"}) {
+        bool ok;
+        auto secs = query.queryItemValue(key).toLongLong(&ok);
+        if (ok) {
+            return secs * 1000;
+        }
+    }
+    return -1;
+}
+
+qint64 PlayUrlCache::expiryOf(const QJsonObject &data)
+{
+    qint64 ret = -1;
+    auto update = [&ret](const QString &url) {
+        auto expiry = urlExpiry(url);
+        if (expiry != -1 && (ret == -1 || expiry < ret)) {
+            ret = expiry;
+        }
+    };
+    for (auto &&durlValR : data["durl"].toArray()) {
+        auto durlObj = durlValR.toObject();
+        update(durlObj["url"].toString());
+        for (auto &&urlValR : durlObj["backup_url"].toArray()) {
+            update(urlValR.toString());
+        }
+    }
+    return (ret == -1 ? QDateTime::currentMSecsSinceEpoch() + DefaultTtl : ret);
+}
+
+QJsonObject PlayUrlCache::get(const QString &key)
+{
+    if (key.isEmpty()) {
+        return QJsonObject();
+    }
+    QMutexLocker locker(&mutex);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return QJsonObject();
+    }
+    if (it->expiry - ExpiryMargin <= QDateTime::currentMSecsSinceEpoch()) {
+        entries.erase(it);
+        return QJsonObject();
+    }
+    return it->data;
+}
+
+void PlayUrlCache::insert(const QString &key, const QJsonObject &data)
+{
+    if (key.isEmpty()) {
+        return;
+    }
+    QMutexLocker locker(&mutex);
+    removeExpired();
+    entries.insert(key, Entry{data, expiryOf(data)});
+}
+
+void PlayUrlCache::remove(const QString &key)
+{
+    QMutexLocker locker(&mutex);
+    entries.remove(key);
+}
+
+void PlayUrlCache::removeExpired()
+{
+    auto now = QDateTime::currentMSecsSinceEpoch();
+    for (auto it = entries.begin(); it != entries.end(); ) {
+        if (it->expiry - ExpiryMargin <= now) {
+            it = entries.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef PLAYURLCACHE_H
+#define PLAYURLCACHE_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+
+/**
+ * @brief PlayUrlCache keeps playurl info (the "data" object of API reply) of video tasks,
+ * so that resuming a task does not request the API again while CDN urls in it are valid.
+ * Expiry is read from deadline/expires param of the urls. Thread-safe.
+ */
+class PlayUrlCache
+{
+public:
+    static PlayUrlCache *inst();
+
+    /**
+     * @return cached data, or empty object if not cached or expired
+     */
+    QJsonObject get(const QString &key);
+    void insert(const QString &key, const QJsonObject &data);
+    void remove(const QString &key);
+
+    /**
+     * @return msecs since epoch when the CDN urls in playurl info expire
+     */
+    static qint64 expiryOf(const QJsonObject &data);
+
+private:
+    struct Entry
+    {
+        QJsonObject data;
+        qint64 expiry;
+    };
+    QMutex mutex;
+    QHash<QString, Entry> entries;
+
+    void removeExpired();
+};
+
+#endif // PLAYURLCACHE_H
@@ -0,0 +1,66 @@
+#include "PlayUrlResolver.h"
+#include "PlayUrlCache.h"
+#include "Network.h"
+#include <QtNetwork>
+
+static constexpr int MinRequestInterval = 1000; // ms
+static constexpr int MaxRequestInterval = 60 * 1000; // ms
+
+PlayUrlResolver::PlayUrlResolver(QObject *parent)
+    : QObject(parent), interval(MinRequestInterval)
+{
+    intervalTimer = new QTimer(this);
+    intervalTimer->setSingleShot(true);
+    connect(intervalTimer, &QTimer::timeout, this, &PlayUrlResolver::requestNext);
+}
+
+PlayUrlResolver::~PlayUrlResolver()
+{
+    if (reply != nullptr) {
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+}
+
+void PlayUrlResolver::setQueue(const QList<Request> &requests)
+{
+    queue = requests;
+    requestNext();
+}
+
+void PlayUrlResolver::requestNext()
+{
+    if (reply != nullptr || intervalTimer->isActive()) {
+        return;
+    }
+
+    auto isCached = [](const Request &request) {
+        return request.cacheKey.isEmpty() || !PlayUrlCache::inst()->get(request.cacheKey).isEmpty();
+    };
+    while (!queue.isEmpty() && isCached(queue.first())) {
+        queue.removeFirst();
+    }
+    if (queue.isEmpty()) {
+        return;
+    }
+
+    auto request = queue.takeFirst();
+    reply = Network::Bili::get(request.url);
+    connect(reply, &QNetworkReply::finished, this, [this, cacheKey = request.cacheKey, dataKey = request.dataKey]{
+        auto reply = this->reply;
+        this->reply = nullptr;
+        reply->deleteLater();
+
+        const auto [json, errorString] = Network::Bili::parseReply(reply, dataKey);
+        if (errorString.isNull()) {
+            PlayUrlCache::inst()->insert(cacheKey, json[dataKey].toObject());
+            interval = MinRequestInterval;
+        } else {
+            // possibly rate limited
+            qDebug() << "prefetch play url failed:" << errorString;
+            interval = std::min(interval * 2, MaxRequestInterval);
+        }
+        intervalTimer->start(interval);
+    });
+}
@@ -0,0 +1,49 @@
+#ifndef PLAYURLRESOLVER_H
+#define PLAYURLRESOLVER_H
+
+#include <QObject>
+
+class QTimer;
+class QNetworkReply;
+
+/**
+ * @brief PlayUrlResolver requests playurl info of waiting tasks in background and puts it
+ * into PlayUrlCache, so that a task starts streaming without an API round-trip when a slot frees.
+ * Requests are sent one at a time with an interval, which is doubled (up to a maximum)
+ * each time the API returns an error.
+ */
+class PlayUrlResolver : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int PrefetchCount = 3;
+
+    /**
+     * @brief playurl request of a task (taken from its snapshot, as tasks live in download threads)
+     */
+    struct Request
+    {
+        QString cacheKey; // key in PlayUrlCache
+        QString url;
+        QString dataKey;
+    };
+
+    PlayUrlResolver(QObject *parent = nullptr);
+    ~PlayUrlResolver();
+
+    /**
+     * @brief replace the queue with requests of tasks (in order) that are going to start next
+     */
+    void setQueue(const QList<Request> &requests);
+
+private:
+    QList<Request> queue;
+    QNetworkReply *reply = nullptr;
+    QTimer *intervalTimer;
+    int interval;
+
+    void requestNext();
+};
+
+#endif // PLAYURLRESOLVER_H
@@ -0,0 +1,90 @@
+#include "ReplayReply.h"
+#include <cstring>
+
+ReplayReply::Response ReplayReply::capture(QNetworkReply *reply)
+{
+    Response ret;
+    ret.url = reply->url();
+    ret.error = reply->error();
+    ret.errorString = reply->errorString();
+    ret.statusCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+    ret.reasonPhrase = reply->attribute(QNetworkRequest::HttpReasonPhraseAttribute);
+    ret.rawHeaders = reply->rawHeaderPairs();
+    ret.content = reply->readAll();
+    return ret;
+}
+
+ReplayReply::ReplayReply(const QNetworkRequest &request, QObject *parent, QNetworkAccessManager::Operation operation)
+    : QNetworkReply(parent)
+{
+    setRequest(request);
+    setUrl(request.url());
+    setOperation(operation);
+    open(QIODevice::ReadOnly);
+}
+
+void ReplayReply::finishWith(const Response &response)
+{
+    if (isFinished()) {
+        return; // aborted
+    }
+    setUrl(response.url);
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, response.statusCode);
+    setAttribute(QNetworkRequest::HttpReasonPhraseAttribute, response.reasonPhrase);
+    for (auto &[name, value] : response.rawHeaders) {
+        setRawHeader(name, value);
+    }
+    if (response.error != NoError) {
+        setError(response.error, response.errorString);
+    }
+    content = response.content;
+    setFinished(true);
+    QMetaObject::invokeMethod(this, &ReplayReply::emitSignals, Qt::QueuedConnection);
+}
+
+void ReplayReply::emitSignals()
+{
+    if (signalsEmitted) {
+        return; // aborted after finishWith()
+    }
+    signalsEmitted = true;
+    emit metaDataChanged();
+    if (!content.isEmpty()) {
+        emit downloadProgress(content.size(), content.size());
+        emit readyRead();
+    }
+    if (error() != NoError) {
+        emit errorOccurred(error());
+    }
+    emit finished();
+}
+
+void ReplayReply::abort()
+{
+    if (signalsEmitted) {
+        return;
+    }
+    signalsEmitted = true;
+    content.clear();
+    readPos = 0;
+    setError(OperationCanceledError, "Operation canceled");
+    setFinished(true);
+    emit errorOccurred(OperationCanceledError);
+    emit finished();
+}
+
+qint64 ReplayReply::bytesAvailable() const
+{
+    return content.size() - readPos + QNetworkReply::bytesAvailable();
+}
+
+qint64 ReplayReply::readData(char *data, qint64 maxSize)
+{
+    auto size = std::min<qint64>(maxSize, content.size() - readPos);
+    if (size <= 0) {
+        return (isFinished() ? -1 : 0);
+    }
+    memcpy(data, content.constData() + readPos, static_cast<size_t>(size));
+    readPos += size;
+    return size;
+}
@@ -0,0 +1,53 @@
+#ifndef REPLAYREPLY_H
+#define REPLAYREPLY_H
+
+#include <QNetworkReply>
+
+/**
+ * @brief ReplayReply is a QNetworkReply whose response is given instead of read from network.
+ * It is used to hand out one network reply to several identical requests (see Network::Bili::get()).
+ * Signals are emitted in a queued way after finishWith(), so that it can be called before
+ * the receiver connects. abort() finishes it synchronously with OperationCanceledError, as QNetworkReply does.
+ */
+class ReplayReply : public QNetworkReply
+{
+    Q_OBJECT
+
+public:
+    struct Response
+    {
+        QUrl url;
+        NetworkError error = NoError;
+        QString errorString;
+        QVariant statusCode;
+        QVariant reasonPhrase;
+        QList<RawHeaderPair> rawHeaders;
+        QByteArray content;
+    };
+
+    /**
+     * @return response of a finished reply. content is read out of it
+     */
+    static Response capture(QNetworkReply *reply);
+
+    ReplayReply(const QNetworkRequest &request, QObject *parent = nullptr,
+                QNetworkAccessManager::Operation operation = QNetworkAccessManager::GetOperation);
+
+    void finishWith(const Response &response);
+
+    void abort() override;
+    qint64 bytesAvailable() const override;
+    bool isSequential() const override { return true; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+
+private:
+    QByteArray content;
+    qint64 readPos = 0;
+    bool signalsEmitted = false;
+
+    void emitSignals();
+};
+
+#endif // REPLAYREPLY_H
@@ -0,0 +1,382 @@
+#include "ReplayServer.h"
+#include "Settings.h"
+#include <QtNetwork>
+
+static constexpr qint64 ChunkSize = 64 * 1024;
+static constexpr qint64 MaxPendingBytes = 256 * 1024; // of socket write buffer
+static constexpr int PacingInterval = 20; // ms
+
+static ReplayServer *instance = nullptr;
+static QThread *serverThread = nullptr;
+static QRandomGenerator faultRandom; // used in server thread only
+
+const ReplayServer::Config &ReplayServer::config()
+{
+    // read on first request, which is in GUI thread
+    static const Config config = []{
+        auto settings = Settings::inst();
+        auto defaultDir = QFileInfo(settings->fileName()).dir().filePath("replay");
+        Config ret;
+        ret.mode = settings->value("replay/mode").toString();
+        ret.dir = settings->value("replay/dir", defaultDir).toString();
+        ret.port = static_cast<quint16>(settings->value("replay/port", 8023).toUInt());
+        ret.latency = settings->value("replay/latency", 0).toInt();
+        ret.bandwidth = settings->value("replay/bandwidth", 0).toLongLong();
+        ret.faultRate = settings->value("replay/faultRate", 0.0).toDouble();
+        ret.seed = settings->value("replay/seed", QRandomGenerator::global()->generate()).toUInt();
+        ret.mediaSize = settings->value("replay/mediaSize", 64 * 1024 * 1024).toLongLong();
+        return ret;
+    }();
+    return config;
+}
+
+QUrl ReplayServer::localUrl(const QUrl &url)
+{
+    auto pathAndQuery = url.toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority | QUrl::RemoveFragment);
+    auto origin = "http://127.0.0.1:" + QByteArray::number(config().port);
+    return QUrl::fromEncoded(origin + '/' + url.host().toUtf8() + pathAndQuery);
+}
+
+QString ReplayServer::recordPath(const QString &host, const QByteArray &pathAndQuery, const QByteArray &body)
+{
+    // POSTs to the same url (e.g. of manga APIs) are told apart by their bodies
+    auto target = (pathAndQuery.startsWith('/') ? pathAndQuery : '/' + pathAndQuery);
+    auto hash = QCryptographicHash::hash(target + '\n' + body, QCryptographicHash::Sha1).toHex();
+    return QDir(config().dir).filePath(host + "/" + QString::fromLatin1(hash) + ".json");
+}
+
+QByteArray ReplayServer::mockRoomBaseInfo(const QByteArray &pathAndQuery)
+{
+    QFile file(QDir(config().dir).filePath("live-rooms.json"));
+    auto rooms = (file.open(QIODevice::ReadOnly) ? QJsonDocument::fromJson(file.readAll()).object() : QJsonObject());
+
+    QJsonObject byRoomIds;
+    auto query = QUrlQuery(QUrl::fromEncoded(pathAndQuery).query());
+    for (auto &roomId : query.allQueryItemValues("room_ids")) {
+        auto room = rooms[roomId].toObject();
+        byRoomIds.insert(roomId, QJsonObject{
+            { "room_id", roomId.toLongLong() },
+            { "short_id", 0 },
+            { "live_status", room["live_status"].toInt(0) },
+            { "uname", room["uname"].toString() },
+            { "title", room["title"].toString() }
+        });
+    }
+    auto data = QJsonObject{{ "by_room_ids", byRoomIds }};
+    return QJsonDocument(QJsonObject{{ "code", 0 }, { "message", "0" }, { "data", data }}).toJson(QJsonDocument::Compact);
+}
+
+void ReplayServer::record(QNetworkReply *reply, const QByteArray &requestBody)
+{
+    auto url = reply->url();
+    // connected before receivers of the caller, so the content is not read yet
+    connect(reply, &QNetworkReply::finished, reply, [reply, url, requestBody]{
+        auto contentType = reply->header(QNetworkRequest::ContentTypeHeader).toString();
+        if (reply->error() != QNetworkReply::NoError) {
+            return;
+        }
+        if (!contentType.contains("json") && !contentType.startsWith("text/")) {
+            return;
+        }
+        auto content = reply->peek(reply->bytesAvailable());
+        auto contentLength = reply->header(QNetworkRequest::ContentLengthHeader);
+        if (contentLength.isValid() && contentLength.toLongLong() != content.size()) {
+            return; // partly read by the receiver
+        }
+
+        auto pathAndQuery = url.toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority | QUrl::RemoveFragment);
+        auto path = recordPath(url.host(), pathAndQuery, requestBody);
+        QFile file(path);
+        if (!QFileInfo(path).dir().mkpath(".") || !file.open(QIODevice::WriteOnly)) {
+            qWarning() << "failed to record response of" << url << "to" << path;
+            return;
+        }
+        file.write(QJsonDocument(QJsonObject{
+            { "url", url.toString() },
+            { "status", reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() },
+            { "reason", reply->attribute(QNetworkRequest::HttpReasonPhraseAttribute).toString() },
+            { "contentType", contentType },
+            { "body", QString::fromLatin1(content.toBase64()) }
+        }).toJson());
+    });
+}
+
+
+/**
+ * @brief serves HTTP/1.1 requests (one at a time, keep-alive) of a connection
+ */
+class ReplayConnection : public QObject
+{
+public:
+    using BodySource = std::function<QByteArray(qint64 pos, qint64 len)>;
+
+    ReplayConnection(QTcpSocket *socket)
+        : QObject(socket), socket(socket)
+    {
+        pacer = new QTimer(this);
+        pacer->setInterval(PacingInterval);
+        connect(pacer, &QTimer::timeout, this, &ReplayConnection::writeBody);
+        connect(socket, &QTcpSocket::readyRead, this, &ReplayConnection::processRequests);
+        connect(socket, &QTcpSocket::bytesWritten, this, &ReplayConnection::writeBody);
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    }
+
+private:
+    QTcpSocket *socket;
+    QTimer *pacer;
+    QByteArray buffer;
+    bool isBusy = false; // a request is being responded
+    bool isWriting = false; // body of the response is being written
+    bool closeAfterResponse = false;
+    bool abortHalfway = false;
+
+    BodySource bodySource;
+    qint64 bodyPos = 0;
+    qint64 bodyEnd = 0;
+    QElapsedTimer pacingTimer;
+
+    void processRequests()
+    {
+        buffer += socket->readAll();
+        if (isBusy) {
+            return;
+        }
+        auto headerEnd = buffer.indexOf("\r\n\r\n");
+        if (headerEnd < 0) {
+            return;
+        }
+
+        auto lines = buffer.left(headerEnd).split('\n');
+        auto requestLine = lines.takeFirst().trimmed().split(' ');
+        if (requestLine.size() != 3) {
+            socket->abort();
+            return;
+        }
+        QHash<QByteArray, QByteArray> headers;
+        for (auto &line : lines) {
+            auto colonPos = line.indexOf(':');
+            if (colonPos > 0) {
+                headers.insert(line.left(colonPos).trimmed().toLower(), line.mid(colonPos + 1).trimmed());
+            }
+        }
+        auto bodyBegin = headerEnd + 4;
+        auto contentLength = headers.value("content-length").toLongLong();
+        if (buffer.size() < bodyBegin + contentLength) {
+            return;
+        }
+        auto body = buffer.mid(bodyBegin, contentLength);
+        buffer.remove(0, bodyBegin + contentLength);
+
+        isBusy = true;
+        closeAfterResponse = (headers.value("connection").toLower() == "close");
+        auto target = requestLine[1];
+        QTimer::singleShot(ReplayServer::config().latency, this, [=]{ respond(target, headers, body); });
+    }
+
+    void respond(const QByteArray &target, const QHash<QByteArray, QByteArray> &headers, const QByteArray &body)
+    {
+        auto &config = ReplayServer::config();
+
+        // target: /host/path?query
+        auto hostEnd = target.indexOf('/', 1);
+        auto host = QString::fromUtf8(hostEnd < 0 ? target.mid(1) : target.mid(1, hostEnd - 1));
+        auto pathAndQuery = (hostEnd < 0 ? QByteArray("/") : target.mid(hostEnd));
+
+        if (config.faultRate > 0 && faultRandom.generateDouble() < config.faultRate) {
+            switch (faultRandom.bounded(3)) {
+            case 0:
+                return sendContent(503, "Service Unavailable", "text/plain", "injected fault");
+            case 1:
+                return sendContent(412, "Precondition Failed", "application/json",
+                                   R"({"code":-412,"message":"injected fault"})");
+            default:
+                abortHalfway = true;
+                break;
+            }
+        }
+
+        if (host == "api.live.bilibili.com" && pathAndQuery.startsWith("/xlive/web-room/v1/index/getRoomBaseInfo")) {
+            return sendContent(200, "OK", "application/json", ReplayServer::mockRoomBaseInfo(pathAndQuery));
+        }
+
+        QFile file(ReplayServer::recordPath(host, pathAndQuery, body));
+        if (file.open(QIODevice::ReadOnly)) {
+            auto obj = QJsonDocument::fromJson(file.readAll()).object();
+            auto content = QByteArray::fromBase64(obj["body"].toString().toLatin1());
+            auto status = obj["status"].toInt(200);
+            auto reason = obj["reason"].toString(status == 200 ? "OK" : QString()).toLatin1(); // recorded by earlier versions without reason
+            return sendContent(status, reason, obj["contentType"].toString().toUtf8(), content);
+        }
+        if (QDir(config.dir).exists(host)) {
+            // an API host without the response recorded
+            return sendContent(404, "Not Found", "application/json", R"({"code":-404,"message":"not recorded"})");
+        }
+        serveMedia(headers.value("range"));
+    }
+
+    void serveMedia(const QByteArray &range)
+    {
+        auto size = ReplayServer::config().mediaSize;
+        qint64 begin = 0;
+        qint64 end = size - 1;
+        QList<std::pair<QByteArray, QByteArray>> headers {
+            { "Content-Type", "application/octet-stream" },
+            { "Accept-Ranges", "bytes" }
+        };
+
+        static const QRegularExpression rangeRegex(R"(^bytes=(\d*)-(\d*)$)");
+        auto m = rangeRegex.match(QString::fromLatin1(range));
+        if (!m.hasMatch()) {
+            return startResponse(200, "OK", headers, size, mediaSource(0));
+        }
+        if (m.capturedView(1).isEmpty()) {
+            begin = size - m.capturedView(2).toLongLong(); // suffix range
+        } else {
+            begin = m.capturedView(1).toLongLong();
+            if (!m.capturedView(2).isEmpty()) {
+                end = std::min(end, m.capturedView(2).toLongLong());
+            }
+        }
+        if (begin < 0 || begin > end) {
+            headers.append({ "Content-Range", "bytes */" + QByteArray::number(size) });
+            return startResponse(416, "Range Not Satisfiable", headers, 0, nullptr);
+        }
+        auto contentRange = QStringLiteral("bytes %1-%2/%3").arg(begin).arg(end).arg(size);
+        headers.append({ "Content-Range", contentRange.toLatin1() });
+        startResponse(206, "Partial Content", headers, end - begin + 1, mediaSource(begin));
+    }
+
+    static BodySource mediaSource(qint64 offset)
+    {
+        return [offset](qint64 pos, qint64 len) {
+            QByteArray data(len, Qt::Uninitialized);
+            for (qint64 i = 0; i < len; i++) {
+                data[i] = char((offset + pos + i) % 251);
+            }
+            return data;
+        };
+    }
+
+    void sendContent(int status, const QByteArray &reason, const QByteArray &contentType, const QByteArray &content)
+    {
+        auto source = [content](qint64 pos, qint64 len) { return content.mid(pos, len); };
+        startResponse(status, reason, {{ "Content-Type", contentType }}, content.size(), source);
+    }
+
+    void startResponse(int status, const QByteArray &reason, const QList<std::pair<QByteArray, QByteArray>> &headers,
+                       qint64 length, BodySource source)
+    {
+        QByteArray head = "HTTP/1.1 " + QByteArray::number(status) + ' ' + reason + "\r\n";
+        for (auto &[name, value] : headers) {
+            head += name + ": " + value + "\r\n";
+        }
+        head += "Content-Length: " + QByteArray::number(length) + "\r\n";
+        if (closeAfterResponse) {
+            head += "Connection: close\r\n";
+        }
+        head += "\r\n";
+        socket->write(head);
+
+        isWriting = true;
+        bodySource = std::move(source);
+        bodyPos = 0;
+        bodyEnd = length;
+        pacingTimer.start();
+        if (ReplayServer::config().bandwidth > 0) {
+            pacer->start();
+        }
+        writeBody();
+    }
+
+    void writeBody()
+    {
+        if (!isWriting) {
+            return;
+        }
+        auto bandwidth = ReplayServer::config().bandwidth;
+        while (bodyPos < bodyEnd && socket->bytesToWrite() < MaxPendingBytes) {
+            auto len = std::min(ChunkSize, bodyEnd - bodyPos);
+            if (bandwidth > 0) {
+                auto allowed = pacingTimer.elapsed() * bandwidth / 1000 - bodyPos;
+                if (allowed <= 0) {
+                    return; // continued by pacer
+                }
+                len = std::min(len, allowed);
+            }
+            if (abortHalfway && bodyPos + len > bodyEnd / 2) {
+                isWriting = false;
+                pacer->stop();
+                socket->abort();
+                return;
+            }
+            socket->write(bodySource(bodyPos, len));
+            bodyPos += len;
+        }
+        if (bodyPos == bodyEnd) {
+            finishResponse();
+        }
+    }
+
+    void finishResponse()
+    {
+        pacer->stop();
+        bodySource = nullptr;
+        bodyPos = bodyEnd = 0;
+        isWriting = false;
+        isBusy = false;
+        abortHalfway = false;
+        if (closeAfterResponse) {
+            socket->disconnectFromHost();
+            return;
+        }
+        // requests pipelined
+        processRequests();
+    }
+};
+
+
+void ReplayServer::startIfEnabled()
+{
+    if (!isReplaying() || instance != nullptr) {
+        return;
+    }
+    serverThread = new QThread;
+    serverThread->setObjectName("ReplayServer");
+    instance = new ReplayServer;
+    instance->moveToThread(serverThread);
+    connect(serverThread, &QThread::finished, instance, &QObject::deleteLater);
+    serverThread->start();
+    QMetaObject::invokeMethod(instance, &ReplayServer::listen, Qt::BlockingQueuedConnection);
+}
+
+void ReplayServer::stop()
+{
+    if (serverThread == nullptr) {
+        return;
+    }
+    serverThread->quit();
+    serverThread->wait();
+    delete serverThread;
+    serverThread = nullptr;
+    instance = nullptr;
+}
+
+void ReplayServer::listen()
+{
+    faultRandom.seed(config().seed);
+    server = new QTcpServer(this);
+    connect(server, &QTcpServer::newConnection, this, &ReplayServer::onNewConnection);
+    if (server->listen(QHostAddress::LocalHost, config().port)) {
+        qInfo() << "replay server listening on port" << config().port << ", dir:" << config().dir
+                << ", seed:" << config().seed;
+    } else {
+        qWarning() << "replay server failed to listen:" << server->errorString();
+    }
+}
+
+void ReplayServer::onNewConnection()
+{
+    while (server->hasPendingConnections()) {
+        new ReplayConnection(server->nextPendingConnection());
+    }
+}
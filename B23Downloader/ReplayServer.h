@@ -0,0 +1,84 @@
+#ifndef REPLAYSERVER_H
+#define REPLAYSERVER_H
+
+#include <QObject>
+#include <QUrl>
+
+class QTcpServer;
+class QThread;
+class QNetworkReply;
+
+/**
+ * @brief ReplayServer is a local stand-in of bilibili for offline runs, configured with Settings "replay/...":
+ *   - mode: "record" saves API responses (JSON or text) under dir while using the real network;
+ *     "replay" sends all requests of Network::accessManager() to the local server, which
+ *     replays the recorded responses and serves synthetic media for other (CDN) urls
+ *   - dir: where responses are recorded (default: "replay" next to the settings file)
+ *   - port: port of the server (default 8023)
+ *   - latency: delay (ms) before each response
+ *   - bandwidth: bytes/s of each connection (0: unlimited)
+ *   - faultRate: probability (0 ~ 1) that a response fails: HTTP 503, HTTP 412 (rate limited),
+ *     or the connection is closed halfway through the body
+ *   - seed: seed of the faults, so that runs can be repeated (default: random, printed at startup)
+ *   - mediaSize: size (bytes) of synthetic media (default 64 MiB). ranges are supported
+ * The settings are read once at startup. The server runs in its own thread.
+ *
+ * In replay mode, room status queried by LiveMonitor (getRoomBaseInfo) is served from
+ * <dir>/live-rooms.json, which is read on every request and can be edited to make rooms go live or offline:
+ *   { "<room id>": { "live_status": 1, "uname": "...", "title": "..." }, ... }
+ * rooms not listed are offline.
+ */
+class ReplayServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Config
+    {
+        QString mode;
+        QString dir;
+        quint16 port;
+        int latency;
+        qint64 bandwidth;
+        double faultRate;
+        quint32 seed;
+        qint64 mediaSize;
+    };
+
+    static const Config &config();
+    static bool isRecording() { return config().mode == "record"; }
+    static bool isReplaying() { return config().mode == "replay"; }
+
+    /**
+     * @brief https://host/path?query -> http://127.0.0.1:port/host/path?query
+     */
+    static QUrl localUrl(const QUrl &url);
+
+    /**
+     * @brief saves response of reply when it's finished (if it's JSON or text). called when reply is created
+     */
+    static void record(QNetworkReply *reply, const QByteArray &requestBody);
+
+    /**
+     * @brief starts the server in replay mode
+     */
+    static void startIfEnabled();
+    static void stop();
+
+private:
+    QTcpServer *server = nullptr;
+
+    static QString recordPath(const QString &host, const QByteArray &pathAndQuery, const QByteArray &body);
+
+    /**
+     * @return response of getRoomBaseInfo built from live-rooms.json
+     */
+    static QByteArray mockRoomBaseInfo(const QByteArray &pathAndQuery);
+
+    void listen();
+    void onNewConnection();
+
+    friend class ReplayConnection;
+};
+
+#endif // REPLAYSERVER_H
@@ -0,0 +1,261 @@
+#include "RetryPolicy.h"
+#include "ReplayReply.h"
+#include "Settings.h"
+#include "ApiRateLimiter.h"
+#include <QtNetwork>
+
+static constexpr int BackoffBaseDelay = 500; // ms
+static constexpr int BackoffMaxDelay = 8000; // ms
+static constexpr int CircuitBaseCooldown = 10 * 1000; // ms
+static constexpr int CircuitMaxCooldown = 5 * 60 * 1000; // ms
+// a request throttled this many times fails
+static constexpr int MaxThrottledAttempts = 6;
+
+// bodies of rate-limit responses are small. larger ones are not parsed
+static constexpr qsizetype MaxRateLimitBodySize = 4096;
+
+static const RetryPolicy::Rule DefaultRules[] = {
+    { "", 3, false },
+    // a download task stops if its play url can't be got
+    { "/x/player/playurl", 4, false },
+    { "/pgc/player/web/playurl", 4, false },
+    { "/pugv/player/web/playurl", 4, false },
+    // read-only APIs of manga.bilibili.com are POSTs
+    { "/twirp/comic.v1.Comic/", 3, true },
+};
+
+Q_GLOBAL_STATIC(RetryPolicy, retryPolicy)
+
+RetryPolicy *RetryPolicy::inst()
+{
+    return retryPolicy;
+}
+
+RetryPolicy::RetryPolicy()
+{
+    elapsedTimer.start();
+    for (auto &rule : DefaultRules) {
+        rules.append(rule);
+    }
+    for (auto &item : Settings::inst()->value("network/retries").toStringList()) {
+        auto prefixAndCnt = item.split('=');
+        bool ok;
+        auto cnt = prefixAndCnt.value(1).trimmed().toInt(&ok);
+        if (prefixAndCnt.size() != 2 || !ok || cnt < 1) {
+            continue;
+        }
+        auto prefix = prefixAndCnt[0].trimmed();
+        auto it = std::find_if(rules.begin(), rules.end(), [&prefix](const Rule &r) { return r.pathPrefix == prefix; });
+        if (it != rules.end()) {
+            it->maxAttempts = cnt;
+        } else {
+            rules.append({ prefix, cnt, false });
+        }
+    }
+}
+
+RetryPolicy::Rule RetryPolicy::ruleOf(const QUrl &url) const
+{
+    auto path = url.path();
+    const Rule *ret = &rules.first();
+    for (auto &rule : rules) {
+        if (path.startsWith(rule.pathPrefix) && rule.pathPrefix.size() > ret->pathPrefix.size()) {
+            ret = &rule;
+        }
+    }
+    return *ret;
+}
+
+int RetryPolicy::backoffDelay(int attemptCnt) const
+{
+    auto delay = BackoffBaseDelay << std::min(attemptCnt - 1, 8);
+    delay = std::min(delay, BackoffMaxDelay);
+    // jitter, so that requests failed together are not retried together
+    return delay / 2 + QRandomGenerator::global()->bounded(delay / 2 + 1);
+}
+
+qint64 RetryPolicy::circuitRemainingTime(const QString &host)
+{
+    QMutexLocker locker(&mutex);
+    auto it = circuits.constFind(host);
+    if (it == circuits.constEnd()) {
+        return 0;
+    }
+    return std::max(it->openUntil - elapsedTimer.elapsed(), qint64(0));
+}
+
+void RetryPolicy::onRateLimited(const QString &host)
+{
+    QMutexLocker locker(&mutex);
+    auto &circuit = circuits[host];
+    auto cooldown = std::min(qint64(CircuitBaseCooldown) << std::min(circuit.tripCnt, 8), qint64(CircuitMaxCooldown));
+    circuit.tripCnt++;
+    circuit.openUntil = elapsedTimer.elapsed() + cooldown;
+    qDebug() << "rate limited by" << host << ", circuit opened for" << cooldown << "ms";
+}
+
+void RetryPolicy::onSucceeded(const QString &host)
+{
+    QMutexLocker locker(&mutex);
+    circuits.remove(host);
+}
+
+
+enum class Outcome { Success, Failure, Retryable, RetryableUnsent, RateLimited };
+
+static Outcome classify(const ReplayReply::Response &response)
+{
+    auto statusCode = response.statusCode.toInt();
+    if (statusCode == 412 || statusCode == 429) {
+        return Outcome::RateLimited;
+    }
+
+    switch (response.error) {
+    case QNetworkReply::NoError:
+        break;
+    case QNetworkReply::ConnectionRefusedError:
+    case QNetworkReply::HostNotFoundError:
+        // the request didn't reach the server
+        return Outcome::RetryableUnsent;
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::OperationCanceledError: // transfer timeout
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::ProxyTimeoutError:
+    case QNetworkReply::UnknownNetworkError:
+        return Outcome::Retryable;
+    default:
+        return (statusCode >= 500 ? Outcome::Retryable : Outcome::Failure);
+    }
+
+    if (response.content.size() <= MaxRateLimitBodySize) {
+        auto code = QJsonDocument::fromJson(response.content).object()["code"].toInt();
+        if (ApiRateLimiter::isThrottleCode(code)) {
+            return Outcome::RateLimited;
+        }
+    }
+    return Outcome::Success;
+}
+
+
+/**
+ * @brief sends attempts of one request, and finishes the reply (its parent) with the last response.
+ * An attempt waits (queued) for a token of ApiRateLimiter, and for the circuit of the host to close
+ */
+class RetryJob : public QObject
+{
+public:
+    RetryJob(const QNetworkRequest &request, bool isPost, RetryPolicy::Transport transport, ReplayReply *reply)
+        : QObject(reply), reply(reply), transport(std::move(transport)), url(request.url()), isPost(isPost)
+    {
+        rule = RetryPolicy::inst()->ruleOf(url);
+        waitTimer = new QTimer(this);
+        waitTimer->setSingleShot(true);
+        connect(waitTimer, &QTimer::timeout, this, &RetryJob::sendAttempt);
+        connect(reply, &QNetworkReply::finished, this, &RetryJob::cancel);
+    }
+
+    ~RetryJob()
+    {
+        cancel();
+    }
+
+    void sendAttempt()
+    {
+        auto circuitRemainingTime = RetryPolicy::inst()->circuitRemainingTime(url.host());
+        if (circuitRemainingTime > 0) {
+            // the token is returned for others. a new one is reserved when the circuit closes
+            returnToken();
+            waitTimer->start(circuitRemainingTime);
+            return;
+        }
+        if (!hasToken) {
+            auto delay = ApiRateLimiter::inst()->reserve(url, &hasToken);
+            if (delay > 0) {
+                // sent when the timer fires if the token is taken, otherwise tries to take one again
+                waitTimer->start(delay);
+                return;
+            }
+        }
+
+        hasToken = false;
+        attempt = transport();
+        connect(attempt, &QNetworkReply::finished, this, &RetryJob::onAttemptFinished);
+    }
+
+private:
+    ReplayReply *reply;
+    RetryPolicy::Transport transport;
+    RetryPolicy::Rule rule;
+    QUrl url;
+    bool isPost;
+    bool hasToken = false;
+    int failedCnt = 0;
+    int throttledCnt = 0;
+    QNetworkReply *attempt = nullptr;
+    QTimer *waitTimer;
+
+    void returnToken()
+    {
+        if (hasToken) {
+            hasToken = false;
+            ApiRateLimiter::inst()->unreserve(url);
+        }
+    }
+
+    void cancel()
+    {
+        waitTimer->stop();
+        returnToken();
+        if (attempt != nullptr) {
+            auto rawAttempt = std::exchange(attempt, nullptr);
+            rawAttempt->disconnect(this);
+            rawAttempt->abort();
+            rawAttempt->deleteLater();
+        }
+    }
+
+    void onAttemptFinished()
+    {
+        auto response = ReplayReply::capture(attempt);
+        std::exchange(attempt, nullptr)->deleteLater();
+
+        auto policy = RetryPolicy::inst();
+        auto limiter = ApiRateLimiter::inst();
+        auto outcome = classify(response);
+        if (outcome == Outcome::Success) {
+            policy->onSucceeded(url.host());
+            limiter->onSucceeded(url);
+        } else if (outcome == Outcome::RateLimited) {
+            policy->onRateLimited(url.host());
+            limiter->onThrottled(url);
+        }
+
+        bool isRetryable = (outcome == Outcome::RetryableUnsent);
+        if (outcome == Outcome::Retryable || outcome == Outcome::RateLimited) {
+            isRetryable = (!isPost || rule.isIdempotentPost);
+        }
+        // throttled attempts are queued again (behind the slowed limiter), without taking attempts of the rule
+        auto isAttemptLeft = (outcome == Outcome::RateLimited ? ++throttledCnt < MaxThrottledAttempts
+                                                              : ++failedCnt < rule.maxAttempts);
+        if (!isRetryable || !isAttemptLeft) {
+            reply->finishWith(response);
+            return;
+        }
+
+        auto delay = (outcome == Outcome::RateLimited ? 0 : policy->backoffDelay(failedCnt));
+        qDebug() << "retry" << url << "in" << delay << "ms, attempt failed:" << response.statusCode << response.error;
+        waitTimer->start(delay);
+    }
+};
+
+
+QNetworkReply *RetryPolicy::send(const QNetworkRequest &request, bool isPost, Transport transport, QObject *parent)
+{
+    auto operation = (isPost ? QNetworkAccessManager::PostOperation : QNetworkAccessManager::GetOperation);
+    auto reply = new ReplayReply(request, parent, operation);
+    auto job = new RetryJob(request, isPost, std::move(transport), reply);
+    job->sendAttempt();
+    return reply;
+}
@@ -0,0 +1,78 @@
+#ifndef RETRYPOLICY_H
+#define RETRYPOLICY_H
+
+#include <QNetworkRequest>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QHash>
+#include <functional>
+
+class QNetworkReply;
+
+/**
+ * @brief RetryPolicy is the retry layer of API requests (Network::Bili::get/postJson/postUrlEncoded).
+ *   - a failed attempt (network error or HTTP 5xx) is retried after exponential backoff
+ *     with jitter, up to maxAttempts of the endpoint's rule
+ *   - POSTs are not retried after they may have reached the server, unless the endpoint is idempotent
+ *   - a rate-limit response (HTTP 412/429, or code -412/-509/-799) opens the circuit of the host:
+ *     until the cooldown ends, requests to it are held back, and the cooldown doubles on every trip in a row.
+ *     the throttled request is queued again (up to a few times), and ApiRateLimiter slows down its endpoint family
+ * Rules can be added or overridden with Settings "network/retries": list of "pathPrefix=maxAttempts".
+ * Requests are sent through a Transport, which can be replaced with a fake one (returning ReplayReply).
+ */
+class RetryPolicy
+{
+public:
+    /**
+     * @brief sends one attempt of the request. called in the thread of send()
+     */
+    using Transport = std::function<QNetworkReply*()>;
+
+    struct Rule
+    {
+        QString pathPrefix;
+        int maxAttempts;
+        bool isIdempotentPost;
+    };
+
+    static RetryPolicy *inst();
+
+    RetryPolicy();
+
+    /**
+     * @return a reply (child of parent) that finishes with the response of the last attempt.
+     *         aborting it aborts the attempt in flight
+     */
+    QNetworkReply *send(const QNetworkRequest &request, bool isPost, Transport transport, QObject *parent);
+
+    /**
+     * @return rule with the longest path prefix matching url
+     */
+    Rule ruleOf(const QUrl &url) const;
+
+    /**
+     * @return delay (ms) before the next attempt, after attemptCnt attempts failed
+     */
+    int backoffDelay(int attemptCnt) const;
+
+    /**
+     * @return time (ms) until the circuit of host closes, 0 if it's closed
+     */
+    qint64 circuitRemainingTime(const QString &host);
+    void onRateLimited(const QString &host);
+    void onSucceeded(const QString &host);
+
+private:
+    QList<Rule> rules;
+
+    struct Circuit
+    {
+        int tripCnt = 0;
+        qint64 openUntil = 0;
+    };
+    QMutex mutex;
+    QHash<QString, Circuit> circuits;
+    QElapsedTimer elapsedTimer;
+};
+
+#endif // RETRYPOLICY_H
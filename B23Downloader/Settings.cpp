@@ -13,16 +13,19 @@ CookieJar::CookieJar(const QString &cookies, QObject *parent)
 
 bool CookieJar::isEmpty() const
 {
+    QMutexLocker locker(&mutex);
     return allCookies().isEmpty();
 }
 
 void CookieJar::clear()
 {
+    QMutexLocker locker(&mutex);
     setAllCookies(QList<QNetworkCookie>());
 }
 
 QByteArray CookieJar::getCookie(const QString &name) const
 {
+    QMutexLocker locker(&mutex);
     for (auto &cookie : allCookies()) {
         if (cookie.name() == name) {
             return cookie.value();
@@ -33,6 +36,7 @@ QByteArray CookieJar::getCookie(const QString &name) const
 
 QString CookieJar::toString() const
 {
+    QMutexLocker locker(&mutex);
     QString ret;
     for (auto &cookie : allCookies()) {
         if (!ret.isEmpty()) {
@@ -50,9 +54,40 @@ void CookieJar::fromString(const QString &data)
     for (auto &cookieStr : cookieStrings) {
         cookies.append(QNetworkCookie::parseCookies(cookieStr.toUtf8()));
     }
+    QMutexLocker locker(&mutex);
     setAllCookies(cookies);
 }
 
+QList<QNetworkCookie> CookieJar::cookiesForUrl(const QUrl &url) const
+{
+    QMutexLocker locker(&mutex);
+    return QNetworkCookieJar::cookiesForUrl(url);
+}
+
+bool CookieJar::setCookiesFromUrl(const QList<QNetworkCookie> &cookieList, const QUrl &url)
+{
+    QMutexLocker locker(&mutex);
+    return QNetworkCookieJar::setCookiesFromUrl(cookieList, url);
+}
+
+bool CookieJar::insertCookie(const QNetworkCookie &cookie)
+{
+    QMutexLocker locker(&mutex);
+    return QNetworkCookieJar::insertCookie(cookie);
+}
+
+bool CookieJar::updateCookie(const QNetworkCookie &cookie)
+{
+    QMutexLocker locker(&mutex);
+    return QNetworkCookieJar::updateCookie(cookie);
+}
+
+bool CookieJar::deleteCookie(const QNetworkCookie &cookie)
+{
+    QMutexLocker locker(&mutex);
+    return QNetworkCookieJar::deleteCookie(cookie);
+}
+
 
 Q_GLOBAL_STATIC(Settings, settings)
 
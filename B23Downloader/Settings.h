@@ -4,6 +4,7 @@
 #include <QNetworkCookieJar>
 #include <QNetworkAccessManager>
 #include <QSettings>
+#include <QMutex>
 
 #include <QColor>
 namespace B23Style {
@@ -11,6 +12,9 @@ namespace B23Style {
     constexpr QColor Blue(0, 161, 214);
 }
 
+/**
+ * @brief thread-safe, as managers of download threads use cookies in it (see Network::accessManager())
+ */
 class CookieJar: public QNetworkCookieJar {
     static constexpr auto CookiesSeparator = '\n';
 
@@ -22,7 +26,14 @@ public:
     void clear();
     QString toString() const;
 
+    QList<QNetworkCookie> cookiesForUrl(const QUrl &url) const override;
+    bool setCookiesFromUrl(const QList<QNetworkCookie> &cookieList, const QUrl &url) override;
+    bool insertCookie(const QNetworkCookie &cookie) override;
+    bool updateCookie(const QNetworkCookie &cookie) override;
+    bool deleteCookie(const QNetworkCookie &cookie) override;
+
 private:
+    mutable QRecursiveMutex mutex;
     void fromString(const QString &cookies);
 };
 
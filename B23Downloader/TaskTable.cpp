@@ -1,11 +1,15 @@
 #include "TaskTable.h"
 #include "DownloadTask.h"
+#include "BufferedWriter.h"
+#include "ComicPipeline.h"
+#include "ConcurrencyScheduler.h"
+#include "DownloadEngine.h"
+#include "PlayUrlResolver.h"
 #include "Settings.h"
 #include "utils.h"
 
 #include <QtWidgets>
 
-static constexpr int MaxConcurrentTaskCount = 3;
 static constexpr int SaveTasksInterval = 5000; // ms
 
 static constexpr int DownRateTimerInterval = 500; // ms
@@ -34,6 +38,27 @@ TaskTableWidget::TaskTableWidget(QWidget *parent)
     saveTasksTimer->setInterval(SaveTasksInterval);
     saveTasksTimer->setSingleShot(false);
     connect(saveTasksTimer, &QTimer::timeout, this, &TaskTableWidget::save);
+
+    scheduler = new ConcurrencyScheduler(this);
+    connect(scheduler, &ConcurrencyScheduler::concurrencyChanged, this, &TaskTableWidget::onConcurrencyChanged);
+    concurrencySampleTimer = new QTimer(this);
+    concurrencySampleTimer->setInterval(ConcurrencyScheduler::SampleInterval);
+    connect(concurrencySampleTimer, &QTimer::timeout, this, &TaskTableWidget::sampleThroughput);
+    concurrencySampleTimer->start();
+
+    playUrlResolver = new PlayUrlResolver(this);
+    connect(concurrencySampleTimer, &QTimer::timeout, this, &TaskTableWidget::prefetchPlayUrls);
+}
+
+// live tasks are not limited, as a waiting live task loses data.
+// comic tasks in batch mode share the image download pool of ComicPipeline instead
+static bool isUnscheduledTask(const TaskCellWidget *cell)
+{
+    auto task = cell->getTask();
+    if (qobject_cast<const LiveDownloadTask*>(task) != nullptr) {
+        return true;
+    }
+    return qobject_cast<const ComicDownloadTask*>(task) != nullptr && ComicPipeline::isBatchMode();
 }
 
 static QAction* createOpenDirAct(QString path)
@@ -55,7 +80,7 @@ void TaskTableWidget::contextMenuEvent(QContextMenuEvent *event)
     auto selection = selectedIndexes();
     if (selection.size() == 1) {
         auto cell = cellWidget(selection.first().row());
-        auto path = cell->getTask()->getPath();
+        auto path = cell->getTask()->getSnapshot().path;
         if (QFileInfo::exists(path)) {
             auto openAct = new QAction("打开");
             connect(openAct, &QAction::triggered, [path](){
@@ -116,12 +141,12 @@ void TaskTableWidget::save()
             // don't save live tasks
             continue;
         }
-        array.append(task->toJsonObj());
+        array.append(task->getSnapshot().json);
     }
     auto settings = Settings::inst();
     settings->setValue("tasks", QJsonDocument(std::move(array)).toJson(QJsonDocument::Compact));
 
-    if (activeTaskCnt == 0) {
+    if (activeTaskCnt == 0 && activeUnscheduledTaskCnt == 0) {
         dirty = false;
         saveTasksTimer->stop();
     }
@@ -146,6 +171,7 @@ void TaskTableWidget::addTasks(const QList<AbstractDownloadTask *> &tasks, bool
     auto shouldSetDirty = false;
     auto rowHt = TaskCellWidget::cellHeight();
     for (auto task : tasks) {
+        DownloadEngine::inst()->adopt(task);
         auto cell = new TaskCellWidget(task);
         int idx = rowCount();
         insertRow(idx);
@@ -157,14 +183,8 @@ void TaskTableWidget::addTasks(const QList<AbstractDownloadTask *> &tasks, bool
         connect(cell, &TaskCellWidget::startBtnClicked, this, &TaskTableWidget::onCellStartBtnClicked);
         connect(cell, &TaskCellWidget::removeBtnClicked, this, &TaskTableWidget::onCellRemoveBtnClicked);
 
-        if (activate) {
-            if (activeTaskCnt < MaxConcurrentTaskCount) {
-                activeTaskCnt++;
-                shouldSetDirty = true;
-                cell->startDownload();
-            } else {
-                cell->setWaitState();
-            }
+        if (activate && tryStartDownload(cell)) {
+            shouldSetDirty = true;
         }
     }
 
@@ -173,12 +193,42 @@ void TaskTableWidget::addTasks(const QList<AbstractDownloadTask *> &tasks, bool
     }
 }
 
+TaskCellWidget *TaskTableWidget::liveCellOf(qint64 roomId) const
+{
+    for (int row = 0; row < rowCount(); row++) {
+        auto cell = cellWidget(row);
+        auto task = qobject_cast<const LiveDownloadTask*>(cell->getTask());
+        if (task != nullptr && task->roomId == roomId && cell->getState() != TaskCellWidget::Finished) {
+            return cell;
+        }
+    }
+    return nullptr;
+}
+
+bool TaskTableWidget::isRecording(qint64 roomId) const
+{
+    return liveCellOf(roomId) != nullptr;
+}
+
+void TaskTableWidget::restartFailedRecording(qint64 roomId)
+{
+    auto cell = liveCellOf(roomId);
+    if (cell != nullptr && cell->isStoppedByError()) {
+        tryStartDownload(cell);
+        setDirty();
+    }
+}
+
 void TaskTableWidget::stopAll()
 {
     for (int row = 0; row < rowCount(); row++) {
         cellWidget(row)->stopDownload();
     }
     activeTaskCnt = 0;
+    activeUnscheduledTaskCnt = 0;
+
+    // so that snapshots saved next are of stopped tasks
+    DownloadEngine::inst()->sync();
 }
 
 void TaskTableWidget::startAll()
@@ -189,12 +239,8 @@ void TaskTableWidget::startAll()
         if (cell->getState() != TaskCellWidget::Stopped) {
             continue;
         }
-        if (activeTaskCnt < MaxConcurrentTaskCount) {
-            activeTaskCnt++;
+        if (tryStartDownload(cell)) {
             shouldSetDirty = true;
-            cell->startDownload();
-        } else {
-            cell->setWaitState();
         }
     }
     if (shouldSetDirty) {
@@ -209,18 +255,45 @@ void TaskTableWidget::removeAll()
         cellWidget(row)->remove();
     }
     activeTaskCnt = 0;
+    activeUnscheduledTaskCnt = 0;
     for (int row = rowCnt - 1; row >= 0; row--) {
         removeRow(row);
     }
+    // removed tasks are being deleted in download threads
+    prefetchPlayUrls();
     if (rowCnt != 0) {
         setDirty();
     }
 }
 
+bool TaskTableWidget::tryStartDownload(TaskCellWidget *cell)
+{
+    if (isUnscheduledTask(cell)) {
+        activeUnscheduledTaskCnt++;
+    } else if (activeTaskCnt < scheduler->concurrency()) {
+        activeTaskCnt++;
+    } else {
+        cell->setWaitState();
+        return false;
+    }
+    cell->startDownload();
+    return true;
+}
+
+void TaskTableWidget::onCellDeactivated(bool isUnscheduled)
+{
+    if (isUnscheduled) {
+        activeUnscheduledTaskCnt--;
+    } else {
+        activeTaskCnt--;
+        activateWaitingTasks();
+    }
+}
+
 void TaskTableWidget::activateWaitingTasks()
 {
     auto rowCnt = rowCount();
-    for (int row = 0; activeTaskCnt < MaxConcurrentTaskCount && row < rowCnt; row++) {
+    for (int row = 0; activeTaskCnt < scheduler->concurrency() && row < rowCnt; row++) {
         auto cell = cellWidget(row);
         if (cell->getState() == TaskCellWidget::Waiting) {
             activeTaskCnt++;
@@ -229,40 +302,86 @@ void TaskTableWidget::activateWaitingTasks()
     }
 }
 
-void TaskTableWidget::onCellTaskStopped()
+void TaskTableWidget::sampleThroughput()
 {
-    activeTaskCnt--;
+    QList<const AbstractDownloadTask*> activeTasks;
+    auto hasWaitingTasks = false;
+    for (int row = 0; row < rowCount(); row++) {
+        auto cell = cellWidget(row);
+        if (cell->getState() == TaskCellWidget::Waiting) {
+            hasWaitingTasks = true;
+        } else if (cell->getState() == TaskCellWidget::Downloading && !isUnscheduledTask(cell)) {
+            activeTasks.append(cell->getTask());
+        }
+    }
+    scheduler->addSample(activeTasks, hasWaitingTasks);
+}
+
+void TaskTableWidget::prefetchPlayUrls()
+{
+    // values are taken from snapshots, as tasks live in download threads
+    QList<PlayUrlResolver::Request> requests;
+    auto rowCnt = rowCount();
+    for (int row = 0; requests.size() < PlayUrlResolver::PrefetchCount && row < rowCnt; row++) {
+        auto cell = cellWidget(row);
+        if (cell->getState() != TaskCellWidget::Waiting) {
+            continue;
+        }
+        auto snapshot = cell->getTask()->getSnapshot();
+        if (!snapshot.playUrlCacheKey.isEmpty()) {
+            requests.append({ snapshot.playUrlCacheKey, snapshot.playUrlInfoUrl, snapshot.playUrlInfoDataKey });
+        }
+    }
+    playUrlResolver->setQueue(requests);
+}
+
+void TaskTableWidget::onConcurrencyChanged(int concurrency)
+{
+    // tasks started last are put back to wait. video tasks resume from where they stopped
+    for (int row = rowCount() - 1; activeTaskCnt > concurrency && row >= 0; row--) {
+        auto cell = cellWidget(row);
+        if (cell->getState() == TaskCellWidget::Downloading && !isUnscheduledTask(cell)) {
+            cell->stopDownload();
+            cell->setWaitState();
+            activeTaskCnt--;
+        }
+    }
     activateWaitingTasks();
 }
 
+void TaskTableWidget::onCellTaskStopped()
+{
+    onCellDeactivated(isUnscheduledTask(static_cast<TaskCellWidget*>(sender())));
+}
+
 void TaskTableWidget::onCellTaskFinished()
 {
     auto cell = static_cast<TaskCellWidget*>(sender());
     QTimer::singleShot(3000, this, [=]{
         removeRow(rowOfCell(cell));
     });
-    activeTaskCnt--;
-    activateWaitingTasks();
+    onCellDeactivated(isUnscheduledTask(cell));
     setDirty();
 }
 
 void TaskTableWidget::onCellStartBtnClicked()
 {
     auto cell = static_cast<TaskCellWidget*>(sender());
-    if (activeTaskCnt < MaxConcurrentTaskCount) {
-        activeTaskCnt++;
-        cell->startDownload();
-    } else {
-        cell->setWaitState();
-    }
-
+    tryStartDownload(cell);
     setDirty();
 }
 
 void TaskTableWidget::onCellRemoveBtnClicked()
 {
     auto cell = static_cast<TaskCellWidget*>(sender());
+    auto wasDownloading = (cell->getState() == TaskCellWidget::Downloading);
+    auto isUnscheduled = isUnscheduledTask(cell);
     removeRow(rowOfCell(cell));
+    if (wasDownloading) {
+        onCellDeactivated(isUnscheduled);
+    }
+    // the removed task is being deleted in download thread
+    prefetchPlayUrls();
     setDirty();
 }
 
@@ -281,7 +400,7 @@ int TaskCellWidget::cellHeight()
 
 TaskCellWidget::~TaskCellWidget()
 {
-    delete task;
+    DownloadEngine::destroy(task);
 }
 
 static void flattenPushButton(QPushButton *btn)
@@ -312,7 +431,8 @@ TaskCellWidget::TaskCellWidget(AbstractDownloadTask *task, QWidget *parent)
 
     auto leftVLayout = new QVBoxLayout;
     titleLabel = new ElidedTextLabel;
-    titleLabel->setText(task->getTitle());
+    auto snapshot = task->getSnapshot();
+    titleLabel->setText(snapshot.title);
     // titleLabel->setHintWidthToString("魔卡少女樱 Clear Card篇 第01话 小樱与透明卡牌");
     auto layoutUnderTitle = new QHBoxLayout;
     qnDescLabel = new QLabel;
@@ -365,7 +485,7 @@ TaskCellWidget::TaskCellWidget(AbstractDownloadTask *task, QWidget *parent)
 
     updateStartStopBtn();
     initProgressWidgets();
-    qnDescLabel->setText(task->getQnDescription());
+    qnDescLabel->setText(snapshot.qnDescription);
 
     if (qobject_cast<LiveDownloadTask*>(task)) {
         timeLeftLabel->setToolTip("已下载时长");
@@ -380,16 +500,9 @@ TaskCellWidget::TaskCellWidget(AbstractDownloadTask *task, QWidget *parent)
 
     connect(iconButton, &QAbstractButton::clicked, this, &TaskCellWidget::open);
 
-    connect(task, &AbstractDownloadTask::errorOccurred, this, &TaskCellWidget::onErrorOccurred);
-
-    connect(task, &AbstractDownloadTask::getUrlInfoFinished, this, [this]{
-       initProgressWidgets();
-       // titleLabel->setText(this->task->getTitle());
-       qnDescLabel->setText(this->task->getQnDescription());
-       startCalcDownRate();
-    });
-
-    connect(task, &AbstractDownloadTask::downloadFinished, this, &TaskCellWidget::onFinished);
+    connect(task, &AbstractDownloadTask::runErrorOccurred, this, &TaskCellWidget::onErrorOccurred);
+    connect(task, &AbstractDownloadTask::runGetUrlInfoFinished, this, &TaskCellWidget::onGetUrlInfoFinished);
+    connect(task, &AbstractDownloadTask::runFinished, this, &TaskCellWidget::onFinished);
 
     connect(startStopButton, &QAbstractButton::clicked, this, &TaskCellWidget::startStopBtnClicked);
 
@@ -401,16 +514,34 @@ TaskCellWidget::TaskCellWidget(AbstractDownloadTask *task, QWidget *parent)
     connect(downRateTimer, &QTimer::timeout, this, &TaskCellWidget::updateDownloadStats);
 }
 
-void TaskCellWidget::onErrorOccurred(const QString &errStr)
+void TaskCellWidget::onErrorOccurred(int runId, const QString &errStr)
 {
+    if (state != State::Downloading || runId != this->runId) {
+        return; // queued from download thread before stopped
+    }
     statusTextLabel->setErrText(errStr);
     state = State::Stopped;
+    hasError = true;
     updateStartStopBtn();
     emit downloadStopped();
 }
 
-void TaskCellWidget::onFinished()
+void TaskCellWidget::onGetUrlInfoFinished(int runId)
 {
+    if (state != State::Downloading || runId != this->runId) {
+        return; // queued from download thread before stopped
+    }
+    initProgressWidgets();
+    // titleLabel->setText(this->task->getTitle());
+    qnDescLabel->setText(this->task->getSnapshot().qnDescription);
+    startCalcDownRate();
+}
+
+void TaskCellWidget::onFinished(int runId)
+{
+    if (state != State::Downloading || runId != this->runId) {
+        return; // stopped meanwhile. it will finish again when started
+    }
     state = State::Finished;
     statusTextLabel->setText("已完成");
     startStopButton->setEnabled(false);
@@ -421,7 +552,7 @@ void TaskCellWidget::onFinished()
 
 void TaskCellWidget::open()
 {
-    auto path = task->getPath();
+    auto path = task->getSnapshot().path;
     if (QFileInfo::exists(path)) {
         QDesktopServices::openUrl(QUrl::fromLocalFile(path));
     }
@@ -429,7 +560,7 @@ void TaskCellWidget::open()
 
 void TaskCellWidget::startCalcDownRate()
 {
-    downRateWindow.append(task->getDownloadedBytesCnt());
+    downRateWindow.append(task->getSnapshot().downloadedBytesCnt);
     downRateTimer->start();
     statusStackedWidget->setCurrentWidget(downloadStatsWidget);
 }
@@ -456,8 +587,9 @@ void TaskCellWidget::initProgressWidgets()
 
 void TaskCellWidget::updateProgressWidgets()
 {
-    progressLabel->setText(task->getProgressStr());
-    auto progress = task->getProgress();
+    auto snapshot = task->getSnapshot();
+    progressLabel->setText(snapshot.progressStr);
+    auto progress = snapshot.progress;
     if (progress >= 0) {
         progressBar->setValue(static_cast<int>(progress * 100));
     }
@@ -465,7 +597,8 @@ void TaskCellWidget::updateProgressWidgets()
 
 void TaskCellWidget::updateDownloadStats()
 {
-    qint64 downloadedBytes = task->getDownloadedBytesCnt();
+    auto snapshot = task->getSnapshot();
+    qint64 downloadedBytes = snapshot.downloadedBytesCnt;
     qint64 bytes = downloadedBytes - downRateWindow.first();
     if (bytes < 0) {
         bytes = 0;
@@ -474,6 +607,21 @@ void TaskCellWidget::updateDownloadStats()
     double seconds = downRateWindow.size() * ((double)DownRateTimerInterval / 1000.0);
     qint64 downBytesPerSec = static_cast<qint64>(static_cast<double>(bytes) / seconds);
     downRateLabel->setText(Utils::formattedDataSize(downBytesPerSec) + "/s");
+    task->setDownRate(downBytesPerSec);
+    auto toolTip = QStringLiteral("下载速度\n写入缓冲: %1 (所有任务: %2/%3)").arg(
+        Utils::formattedDataSize(snapshot.bufferedBytesCnt),
+        Utils::formattedDataSize(BufferBudget::usedBytes()),
+        Utils::formattedDataSize(BufferBudget::limit())
+    );
+    if (snapshot.stallCnt > 0 || snapshot.reconnectCnt > 0) {
+        toolTip += QStringLiteral("\n连接卡顿: %1 次, 自动重连: %2 次").arg(snapshot.stallCnt).arg(snapshot.reconnectCnt);
+    }
+    if (snapshot.lastReconnectLatency >= 0) {
+        auto gap = snapshot.lastReconnectGap;
+        toolTip += QStringLiteral("\n上次重连耗时: %1 ms, 内容间断: %2").arg(snapshot.lastReconnectLatency)
+                   .arg(gap < 0 ? QStringLiteral("未知") : QString::number(gap) + " ms");
+    }
+    downRateLabel->setToolTip(toolTip);
 
     if (downRateWindow.size() == DownRateWindowLength) {
         downRateWindow.removeFirst();
@@ -481,9 +629,14 @@ void TaskCellWidget::updateDownloadStats()
     downRateWindow.append(downloadedBytes);
 
     auto infTime = "--:--:--";
-    auto secs = task->estimateRemainingSeconds(downBytesPerSec);
+    // estimated in download thread with rate set above (or the last one)
+    auto secs = snapshot.remainingSeconds;
     // secs > 99 * 3600
-    timeLeftLabel->setText(secs < 0 ? infTime : Utils::secs2HmsStr(secs));
+    if (snapshot.reconnecting) {
+        timeLeftLabel->setText("重连中");
+    } else {
+        timeLeftLabel->setText(secs < 0 ? infTime : Utils::secs2HmsStr(secs));
+    }
 
     updateProgressWidgets();
 }
@@ -524,7 +677,7 @@ void TaskCellWidget::stopDownload()
     }
     statusTextLabel->setText("暂停中");
     if (state == State::Downloading) {
-        task->stopDownload();
+        QMetaObject::invokeMethod(task, &AbstractDownloadTask::stopDownload);
         stopCalcDownRate();
     }
     state = State::Stopped;
@@ -533,8 +686,8 @@ void TaskCellWidget::stopDownload()
 
 void TaskCellWidget::remove()
 {
-    task->stopDownload();
-    task->removeFile();
+    QMetaObject::invokeMethod(task, &AbstractDownloadTask::stopDownload);
+    QMetaObject::invokeMethod(task, &AbstractDownloadTask::removeFile);
 }
 
 void TaskCellWidget::setWaitState()
@@ -554,6 +707,8 @@ void TaskCellWidget::startDownload()
     }
     statusTextLabel->setText("请求中");
     state = State::Downloading;
-    task->startDownload();
+    hasError = false;
+    runId++;
+    QMetaObject::invokeMethod(task, [task = task, id = runId]{ task->startRun(id); });
     updateStartStopBtn();
 }
@@ -12,6 +12,8 @@ class QPushButton;
 class QStackedWidget;
 
 class AbstractDownloadTask;
+class ConcurrencyScheduler;
+class PlayUrlResolver;
 class ElidedTextLabel;
 class TaskCellWidget;
 
@@ -26,6 +28,16 @@ public:
     void load();
     void addTasks(const QList<AbstractDownloadTask*> &, bool activate = true);
 
+    /**
+     * @return whether there is a live task of the room (in any state), so that another one is not added
+     */
+    bool isRecording(qint64 roomId) const;
+
+    /**
+     * @brief start the live task of the room again if it was stopped by an error (not by user)
+     */
+    void restartFailedRecording(qint64 roomId);
+
     void stopAll();
     void startAll();
     void removeAll();
@@ -42,6 +54,7 @@ protected:
 private:
     TaskCellWidget *cellWidget(int row) const;
     int rowOfCell(TaskCellWidget *cell) const;
+    TaskCellWidget *liveCellOf(qint64 roomId) const;
 
     QAction *startAllAct;
     QAction *stopAllAct;
@@ -51,8 +64,22 @@ private:
     QTimer *saveTasksTimer;
     void setDirty();
 
-    int activeTaskCnt = 0;
+    int activeTaskCnt = 0;     // tasks limited by scheduler
+    int activeUnscheduledTaskCnt = 0; // live tasks, and comic tasks in batch mode
+    ConcurrencyScheduler *scheduler;
+    QTimer *concurrencySampleTimer;
+    PlayUrlResolver *playUrlResolver;
+
+    /**
+     * @brief start download if concurrency allows, otherwise set the cell to wait state
+     * @return whether download is started
+     */
+    bool tryStartDownload(TaskCellWidget *cell);
+    void onCellDeactivated(bool isUnscheduled);
     void activateWaitingTasks();
+    void sampleThroughput();
+    void prefetchPlayUrls(); // of waiting tasks to be started next
+    void onConcurrencyChanged(int concurrency);
 };
 
 
@@ -66,6 +93,8 @@ public:
 
 private:
     State state = Stopped;
+    bool hasError = false; // stopped by errorOccurred()
+    int runId = 0; // increased on each start. signals of earlier runs are ignored
     AbstractDownloadTask *task = nullptr;
 
 public:
@@ -75,6 +104,7 @@ public:
 
     const AbstractDownloadTask *getTask() const { return task; }
     State getState() const { return state; }
+    bool isStoppedByError() const { return state == Stopped && hasError; }
     void setState(State);
 
     void setWaitState();
@@ -90,8 +120,9 @@ signals:
     void removeBtnClicked();
 
 private slots:
-    void onErrorOccurred(const QString &errStr);
-    void onFinished();
+    void onErrorOccurred(int runId, const QString &errStr);
+    void onGetUrlInfoFinished(int runId);
+    void onFinished(int runId);
     void open();
 
 private:
@@ -0,0 +1,183 @@
+#include "UrlClassifier.h"
+#include <QRegularExpression>
+#include <QUrlQuery>
+#include <QHash>
+
+namespace UrlClassifier {
+
+using QRegExp = QRegularExpression;
+
+static QRegExp compiled(const char *pattern)
+{
+    QRegExp re(QString::fromLatin1(pattern));
+    re.optimize();
+    return re;
+}
+
+static Result idResult(Kind kind, QStringView id)
+{
+    Result ret;
+    ret.kind = kind;
+    ret.id = id.toLongLong();
+    return ret;
+}
+
+static Result urlResult(Kind kind, const QUrl &url)
+{
+    Result ret;
+    ret.kind = kind;
+    ret.url = url;
+    return ret;
+}
+
+// www.bilibili.com, m.bilibili.com
+static Result classifyMainSite(const QUrl &url)
+{
+    static const auto playRegex = compiled(R"(^/(bangumi|cheese)/play/(ss|ep)(\d+)/?$)");
+    static const auto mediaRegex = compiled(R"(^/bangumi/media/md(\d+)/?$)");
+    static const auto videoRegex = compiled(R"(^/(?:(?:s/)?video/)?(?:(?:BV|bv)([a-zA-Z0-9]+)|av(\d+))/?$)");
+
+    auto path = url.path();
+    QRegularExpressionMatch m;
+    if (path.startsWith(QLatin1String("/bangumi/")) || path.startsWith(QLatin1String("/cheese/"))) {
+        if ((m = playRegex.match(path)).hasMatch()) {
+            auto isSeason = (m.capturedView(2) == QLatin1String("ss"));
+            if (m.capturedView(1) == QLatin1String("bangumi")) {
+                return idResult(isSeason ? Kind::PgcSeasonId : Kind::PgcEpisodeId, m.capturedView(3));
+            } else {
+                return idResult(isSeason ? Kind::PugvSeasonId : Kind::PugvEpisodeId, m.capturedView(3));
+            }
+        }
+        if ((m = mediaRegex.match(path)).hasMatch()) {
+            return idResult(Kind::PgcMediaId, m.capturedView(1));
+        }
+        return Result();
+    }
+
+    Result ret;
+    if ((m = videoRegex.match(path)).hasMatch()) {
+        if (m.capturedLength(1) > 0) {
+            ret.kind = Kind::UgcBvId;
+            ret.bvid = "BV" + m.captured(1);
+        } else {
+            ret = idResult(Kind::UgcAvId, m.capturedView(2));
+        }
+        ret.focusItemId = QUrlQuery(url).queryItemValue("p").toLongLong();
+    }
+    return ret;
+}
+
+static Result classifyBangumiSite(const QUrl &url)
+{
+    static const auto animeRegex = compiled(R"(^/anime/(\d+)/?$)");
+    auto m = animeRegex.match(url.path());
+    return m.hasMatch() ? idResult(Kind::PgcSeasonId, m.capturedView(1)) : Result();
+}
+
+static Result classifyLiveSite(const QUrl &url)
+{
+    static const auto roomRegex = compiled(R"(^/(?:h5/)?(\d+)/?$)");
+    static const auto activityRegex = compiled(R"(^/blackboard/activity-.*\.html$)");
+    auto path = url.path();
+    QRegularExpressionMatch m;
+    if ((m = roomRegex.match(path)).hasMatch()) {
+        return idResult(Kind::LiveRoom, m.capturedView(1));
+    }
+    if (activityRegex.match(path).hasMatch()) {
+        return urlResult(Kind::LiveActivity, url);
+    }
+    return Result();
+}
+
+// b23.tv
+static Result classifyShortLink(const QUrl &url)
+{
+    static const auto pgcRegex = compiled(R"(^/(ss|ep)(\d+)$)");
+    auto m = pgcRegex.match(url.path());
+    if (m.hasMatch()) {
+        auto isSeason = (m.capturedView(1) == QLatin1String("ss"));
+        return idResult(isSeason ? Kind::PgcSeasonId : Kind::PgcEpisodeId, m.capturedView(2));
+    }
+    return urlResult(Kind::Redirect, url);
+}
+
+static Result classifyRedirect(const QUrl &url)
+{
+    return urlResult(Kind::Redirect, url);
+}
+
+static Result classifyMangaSite(const QUrl &url)
+{
+    static const auto detailRegex = compiled(R"(^/(?:m/)?detail/mc(\d+)/?$)");
+    static const auto episodeRegex = compiled(R"(^/(?:m/)?mc(\d+)/(\d+)/?$)");
+    auto path = url.path();
+    QRegularExpressionMatch m;
+    if ((m = detailRegex.match(path)).hasMatch()) {
+        auto ret = idResult(Kind::Comic, m.capturedView(1));
+        ret.focusItemId = QUrlQuery(url).queryItemValue("epId").toLongLong();
+        return ret;
+    }
+    if ((m = episodeRegex.match(path)).hasMatch()) {
+        auto ret = idResult(Kind::Comic, m.capturedView(1));
+        ret.focusItemId = m.capturedView(2).toLongLong();
+        return ret;
+    }
+    return Result();
+}
+
+Result classifyUrl(const QUrl &url)
+{
+    using Classifier = Result (*)(const QUrl &);
+    static const QHash<QString, Classifier> hostClassifiers {
+        { "bilibili.com", classifyMainSite },
+        { "www.bilibili.com", classifyMainSite },
+        { "m.bilibili.com", classifyMainSite },
+        { "bangumi.bilibili.com", classifyBangumiSite },
+        { "live.bilibili.com", classifyLiveSite },
+        { "manga.bilibili.com", classifyMangaSite },
+        { "b23.tv", classifyShortLink },
+        { "b22.top", classifyRedirect },
+    };
+
+    auto classifier = hostClassifiers.value(url.authority().toLower());
+    return (classifier == nullptr ? Result() : classifier(url));
+}
+
+Result classify(const QString &input)
+{
+    static const auto bvRegex = compiled(R"(^(?:BV|bv)([a-zA-Z0-9]+)$)");
+    static const auto avRegex = compiled(R"(^av(\d+)$)");
+    static const auto pgcRegex = compiled(R"(^(ss|ep)(\d+)$)");
+    static const auto liveRegex = compiled(R"(^live(\d+)$)");
+
+    // short forms, told apart by the first characters
+    QRegularExpressionMatch m;
+    if (input.startsWith(QLatin1String("BV")) || input.startsWith(QLatin1String("bv"))) {
+        if ((m = bvRegex.match(input)).hasMatch()) {
+            Result ret;
+            ret.kind = Kind::UgcBvId;
+            ret.bvid = "BV" + m.captured(1);
+            return ret;
+        }
+    } else if (input.startsWith(QLatin1String("av"))) {
+        if ((m = avRegex.match(input)).hasMatch()) {
+            return idResult(Kind::UgcAvId, m.capturedView(1));
+        }
+    } else if (input.startsWith(QLatin1String("ss")) || input.startsWith(QLatin1String("ep"))) {
+        if ((m = pgcRegex.match(input)).hasMatch()) {
+            auto isSeason = (m.capturedView(1) == QLatin1String("ss"));
+            return idResult(isSeason ? Kind::PgcSeasonId : Kind::PgcEpisodeId, m.capturedView(2));
+        }
+    } else if (input.startsWith(QLatin1String("live"))) {
+        if ((m = liveRegex.match(input)).hasMatch()) {
+            return idResult(Kind::LiveRoom, m.capturedView(1));
+        }
+    }
+
+    if (!input.startsWith(QLatin1String("http://")) && !input.startsWith(QLatin1String("https://"))) {
+        return classifyUrl(QUrl("https://" + input));
+    }
+    return classifyUrl(QUrl(input));
+}
+
+} // namespace UrlClassifier
@@ -0,0 +1,47 @@
+#ifndef URLCLASSIFIER_H
+#define URLCLASSIFIER_H
+
+#include <QUrl>
+
+/**
+ * @brief UrlClassifier tells what an input of Extractor (url or short form like BV.../ss.../live...) refers to.
+ * Short forms are told apart by their first characters and urls by their hosts (a dispatch table),
+ * so that only one or a few precompiled patterns are matched against each input.
+ */
+namespace UrlClassifier {
+
+enum class Kind
+{
+    Unsupported,
+    UgcBvId,        // bvid
+    UgcAvId,        // id
+    PgcSeasonId,    // id
+    PgcEpisodeId,   // id
+    PgcMediaId,     // id
+    PugvSeasonId,   // id
+    PugvEpisodeId,  // id
+    LiveRoom,       // id
+    LiveActivity,   // url
+    Comic,          // id, focusItemId: episode id
+    Redirect,       // url (short link)
+};
+
+struct Result
+{
+    Kind kind = Kind::Unsupported;
+    qint64 id = 0;
+    QString bvid;
+    qint64 focusItemId = 0;
+    QUrl url;
+};
+
+/**
+ * @param input trimmed user input. url without scheme is taken as https
+ */
+Result classify(const QString &input);
+
+Result classifyUrl(const QUrl &url);
+
+} // namespace UrlClassifier
+
+#endif // URLCLASSIFIER_H
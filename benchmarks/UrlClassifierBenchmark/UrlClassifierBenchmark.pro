@@ -0,0 +1,20 @@
+# Benchmark of UrlClassifier against the per-call regex matching it replaced:
+#   qmake && make && ./UrlClassifierBenchmark
+# (-iterations n, -median n... of QtTest can be given)
+
+QT       += core testlib
+QT       -= gui
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = UrlClassifierBenchmark
+
+INCLUDEPATH += ../../B23Downloader
+
+SOURCES += \
+    ../../B23Downloader/UrlClassifier.cpp \
+    tst_UrlClassifierBenchmark.cpp
+
+HEADERS += \
+    ../../B23Downloader/UrlClassifier.h
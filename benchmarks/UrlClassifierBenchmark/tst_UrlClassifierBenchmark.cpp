@@ -0,0 +1,236 @@
+#include "UrlClassifier.h"
+#include <QtTest>
+
+using QRegExp = QRegularExpression;
+using UrlClassifier::Kind;
+using UrlClassifier::Result;
+
+namespace Legacy {
+
+// classification of Extractor::start() / parseUrl() before UrlClassifier: patterns are compiled on each call
+
+static Result idResult(Kind kind, qint64 id)
+{
+    Result ret;
+    ret.kind = kind;
+    ret.id = id;
+    return ret;
+}
+
+static Result urlResult(Kind kind, const QUrl &url)
+{
+    Result ret;
+    ret.kind = kind;
+    ret.url = url;
+    return ret;
+}
+
+static Result bvResult(const QString &bvid, qint64 focusItemId = 0)
+{
+    Result ret;
+    ret.kind = Kind::UgcBvId;
+    ret.bvid = bvid;
+    ret.focusItemId = focusItemId;
+    return ret;
+}
+
+static Result parseUrl(const QUrl &url)
+{
+    auto host = url.authority().toLower();
+    auto path = url.path();
+    auto query = QUrlQuery(url);
+    QRegularExpressionMatch m;
+
+    if (QRegExp(R"(^(?:www\.|m\.)?bilibili\.com$)").match(host).hasMatch()) {
+        if ((m = QRegExp(R"(^/bangumi/play/(ss|ep)(\d+)/?$)").match(path)).hasMatch()) {
+            auto kind = (m.captured(1) == "ss" ? Kind::PgcSeasonId : Kind::PgcEpisodeId);
+            return idResult(kind, m.captured(2).toLongLong());
+        }
+        if ((m = QRegExp(R"(^/bangumi/media/md(\d+)/?$)").match(path)).hasMatch()) {
+            return idResult(Kind::PgcMediaId, m.captured(1).toLongLong());
+        }
+        if ((m = QRegExp(R"(^/cheese/play/(ss|ep)(\d+)/?$)").match(path)).hasMatch()) {
+            auto kind = (m.captured(1) == "ss" ? Kind::PugvSeasonId : Kind::PugvEpisodeId);
+            return idResult(kind, m.captured(2).toLongLong());
+        }
+
+        auto focusItemId = query.queryItemValue("p").toLongLong();
+        if ((m = QRegExp(R"(^/(?:(?:s/)?video/)?(?:BV|bv)([a-zA-Z0-9]+)/?$)").match(path)).hasMatch()) {
+            return bvResult("BV" + m.captured(1), focusItemId);
+        }
+        if ((m = QRegExp(R"(^/(?:(?:s/)?video/)?av(\d+)/?$)").match(path)).hasMatch()) {
+            auto ret = idResult(Kind::UgcAvId, m.captured(1).toLongLong());
+            ret.focusItemId = focusItemId;
+            return ret;
+        }
+        return Result();
+    }
+
+    if (host == "bangumi.bilibili.com") {
+        if ((m = QRegExp(R"(^/anime/(\d+)/?$)").match(path)).hasMatch()) {
+            return idResult(Kind::PgcSeasonId, m.captured(1).toLongLong());
+        }
+        return Result();
+    }
+
+    if (host == "live.bilibili.com") {
+        if ((m = QRegExp(R"(^/(?:h5/)?(\d+)/?$)").match(path)).hasMatch()) {
+            return idResult(Kind::LiveRoom, m.captured(1).toLongLong());
+        }
+        if ((m = QRegExp(R"(^/blackboard/activity-.*\.html$)").match(path)).hasMatch()) {
+            return urlResult(Kind::LiveActivity, url);
+        }
+        return Result();
+    }
+
+    if (host == "b23.tv") {
+        if ((m = QRegExp(R"(^/(ss|ep)(\d+)$)").match(path)).hasMatch()) {
+            auto kind = (m.captured(1) == "ss" ? Kind::PgcSeasonId : Kind::PgcEpisodeId);
+            return idResult(kind, m.captured(2).toLongLong());
+        }
+        return urlResult(Kind::Redirect, url);
+    }
+
+    if (host == "manga.bilibili.com") {
+        if ((m = QRegExp(R"(^/(?:m/)?detail/mc(\d+)/?$)").match(path)).hasMatch()) {
+            auto ret = idResult(Kind::Comic, m.captured(1).toLongLong());
+            ret.focusItemId = query.queryItemValue("epId").toLongLong();
+            return ret;
+        }
+        if ((m = QRegExp(R"(^/(?:m/)?mc(\d+)/(\d+)/?$)").match(path)).hasMatch()) {
+            auto ret = idResult(Kind::Comic, m.captured(1).toLongLong());
+            ret.focusItemId = m.captured(2).toLongLong();
+            return ret;
+        }
+        return Result();
+    }
+
+    if (host == "b22.top") {
+        return urlResult(Kind::Redirect, url);
+    }
+    return Result();
+}
+
+static Result classify(const QString &input)
+{
+    QRegularExpressionMatch m;
+
+    if ((m = QRegExp("^(?:BV|bv)([a-zA-Z0-9]+)$").match(input)).hasMatch()) {
+        return bvResult("BV" + m.captured(1));
+    }
+    if ((m = QRegExp(R"(^av(\d+)$)").match(input)).hasMatch()) {
+        return idResult(Kind::UgcAvId, m.captured(1).toLongLong());
+    }
+    if ((m = QRegExp(R"(^(ss|ep)(\d+)$)").match(input)).hasMatch()) {
+        auto kind = (m.captured(1) == "ss" ? Kind::PgcSeasonId : Kind::PgcEpisodeId);
+        return idResult(kind, m.captured(2).toLongLong());
+    }
+    if ((m = QRegExp(R"(^live(\d+)$)").match(input)).hasMatch()) {
+        return idResult(Kind::LiveRoom, m.captured(1).toLongLong());
+    }
+
+    if (!input.startsWith("http://") && !input.startsWith("https://")) {
+        return parseUrl(QUrl("https://" + input));
+    }
+    return parseUrl(QUrl(input));
+}
+
+} // namespace Legacy
+
+
+class UrlClassifierBenchmark : public QObject
+{
+    Q_OBJECT
+
+private:
+    QStringList corpus;
+
+private slots:
+    void initTestCase();
+    void sameResults();
+    void legacyClassify();
+    void classify();
+};
+
+void UrlClassifierBenchmark::initTestCase()
+{
+    // shapes of urls pasted into Extractor. ids vary so that nothing is shared between inputs
+    static const char *shapes[] = {
+        "BV1%1xx411c7mD",
+        "bv1%1xx411c7mD",
+        "av%1",
+        "ss%1",
+        "ep%1",
+        "live%1",
+        "https://www.bilibili.com/video/BV1%1xx411c7mD",
+        "https://www.bilibili.com/video/BV1%1xx411c7mD/?p=3&spm_id_from=333.788.videopod.episodes",
+        "https://www.bilibili.com/video/av%1/",
+        "https://m.bilibili.com/video/BV1%1xx411c7mD?share_source=copy_web",
+        "www.bilibili.com/s/video/BV1%1xx411c7mD",
+        "bilibili.com/av%1",
+        "https://www.bilibili.com/bangumi/play/ss%1",
+        "https://www.bilibili.com/bangumi/play/ep%1/?from_spmid=666.25.episode.0",
+        "https://www.bilibili.com/bangumi/media/md%1/",
+        "https://www.bilibili.com/cheese/play/ss%1",
+        "https://www.bilibili.com/cheese/play/ep%1?csource=common_hp_history_null",
+        "https://bangumi.bilibili.com/anime/%1",
+        "https://live.bilibili.com/%1?broadcast_type=0&is_room_feed=1",
+        "live.bilibili.com/h5/%1",
+        "https://live.bilibili.com/blackboard/activity-%1.html",
+        "https://b23.tv/ep%1",
+        "https://b23.tv/Ab%1Cd",
+        "b22.top/Ab%1Cd",
+        "https://manga.bilibili.com/detail/mc%1?from=manga_homepage",
+        "https://manga.bilibili.com/m/detail/mc%1?epId=401214",
+        "https://manga.bilibili.com/mc%1/401214?from=manga_detail",
+        "https://space.bilibili.com/%1/video",
+        "https://www.bilibili.com/read/cv%1",
+        "https://www.youtube.com/watch?v=%1",
+    };
+    for (int i = 0; i < 500; i++) {
+        for (auto shape : shapes) {
+            corpus.append(QString::fromLatin1(shape).arg(10000 + i * 7919));
+        }
+    }
+}
+
+void UrlClassifierBenchmark::sameResults()
+{
+    for (auto &input : corpus) {
+        auto expected = Legacy::classify(input);
+        auto actual = UrlClassifier::classify(input);
+        QVERIFY2(actual.kind == expected.kind, qPrintable(input));
+        QCOMPARE(actual.id, expected.id);
+        QCOMPARE(actual.bvid, expected.bvid);
+        QCOMPARE(actual.focusItemId, expected.focusItemId);
+        QCOMPARE(actual.url, expected.url);
+    }
+}
+
+void UrlClassifierBenchmark::legacyClassify()
+{
+    int supportedCnt = 0;
+    QBENCHMARK {
+        supportedCnt = 0;
+        for (auto &input : corpus) {
+            supportedCnt += (Legacy::classify(input).kind != Kind::Unsupported);
+        }
+    }
+    QVERIFY(supportedCnt > 0);
+}
+
+void UrlClassifierBenchmark::classify()
+{
+    int supportedCnt = 0;
+    QBENCHMARK {
+        supportedCnt = 0;
+        for (auto &input : corpus) {
+            supportedCnt += (UrlClassifier::classify(input).kind != Kind::Unsupported);
+        }
+    }
+    QVERIFY(supportedCnt > 0);
+}
+
+QTEST_APPLESS_MAIN(UrlClassifierBenchmark)
+
+#include "tst_UrlClassifierBenchmark.moc"
@@ -0,0 +1,24 @@
+# Tests of RetryPolicy with a fake transport:
+#   qmake && make && ./RetryPolicyTest
+
+QT       += core gui network testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = RetryPolicyTest
+
+INCLUDEPATH += ../../B23Downloader
+
+SOURCES += \
+    ../../B23Downloader/ApiRateLimiter.cpp \
+    ../../B23Downloader/ReplayReply.cpp \
+    ../../B23Downloader/RetryPolicy.cpp \
+    ../../B23Downloader/Settings.cpp \
+    tst_RetryPolicy.cpp
+
+HEADERS += \
+    ../../B23Downloader/ApiRateLimiter.h \
+    ../../B23Downloader/ReplayReply.h \
+    ../../B23Downloader/RetryPolicy.h \
+    ../../B23Downloader/Settings.h
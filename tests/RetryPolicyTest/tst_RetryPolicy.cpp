@@ -0,0 +1,206 @@
+#include "RetryPolicy.h"
+#include "ReplayReply.h"
+#include <QtTest>
+
+/**
+ * @brief transport of RetryPolicy that answers attempts with given responses (the last one repeated)
+ */
+class FakeTransport
+{
+public:
+    FakeTransport(const QNetworkRequest &request, const QList<ReplayReply::Response> &responses)
+        : request(request), responses(responses) {}
+
+    int attemptCnt = 0;
+
+    RetryPolicy::Transport transport()
+    {
+        return [this]() -> QNetworkReply* {
+            auto response = responses.value(attemptCnt, responses.last());
+            response.url = request.url();
+            attemptCnt++;
+            auto reply = new ReplayReply(request);
+            reply->finishWith(response);
+            return reply;
+        };
+    }
+
+private:
+    QNetworkRequest request;
+    QList<ReplayReply::Response> responses;
+};
+
+static ReplayReply::Response httpResponse(int statusCode, const QByteArray &content = QByteArray())
+{
+    ReplayReply::Response ret;
+    ret.statusCode = statusCode;
+    ret.content = content;
+    if (statusCode >= 400) {
+        ret.error = (statusCode >= 500 ? QNetworkReply::InternalServerError : QNetworkReply::UnknownContentError);
+        ret.errorString = QString("HTTP %1").arg(statusCode);
+    }
+    return ret;
+}
+
+static ReplayReply::Response errorResponse(QNetworkReply::NetworkError error)
+{
+    ReplayReply::Response ret;
+    ret.error = error;
+    ret.errorString = "network error";
+    return ret;
+}
+
+
+class RetryPolicyTest : public QObject
+{
+    Q_OBJECT
+
+private:
+    QTemporaryDir settingsDir;
+
+    /**
+     * @return the reply, finished (or not, if timeout)
+     */
+    QNetworkReply *send(const QString &url, bool isPost, FakeTransport &fake, int timeout = 5000);
+
+private slots:
+    void initTestCase();
+    void backoffDelay();
+    void retriesUntilMaxAttempts();
+    void stopsRetryingOnSuccess();
+    void doesNotRetryClientError();
+    void opensCircuitOnRateLimitCode();
+    void doesNotRetrySentPost();
+    void retriesUnsentPost();
+    void retriesIdempotentPost();
+};
+
+QNetworkReply *RetryPolicyTest::send(const QString &url, bool isPost, FakeTransport &fake, int timeout)
+{
+    auto reply = RetryPolicy::inst()->send(QNetworkRequest(QUrl(url)), isPost, fake.transport(), this);
+    QSignalSpy finishedSpy(reply, &QNetworkReply::finished);
+    finishedSpy.wait(timeout);
+    return reply;
+}
+
+void RetryPolicyTest::initTestCase()
+{
+    // Settings (rules and rate limits) are read from an empty directory instead of the user's
+    QVERIFY(settingsDir.isValid());
+    QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, settingsDir.path());
+}
+
+void RetryPolicyTest::backoffDelay()
+{
+    auto policy = RetryPolicy::inst();
+    for (int attemptCnt = 1; attemptCnt <= 12; attemptCnt++) {
+        auto maxDelay = std::min(500 << std::min(attemptCnt - 1, 8), 8000);
+        for (int i = 0; i < 50; i++) {
+            auto delay = policy->backoffDelay(attemptCnt);
+            QVERIFY(delay >= maxDelay / 2);
+            QVERIFY(delay <= maxDelay);
+        }
+    }
+}
+
+void RetryPolicyTest::retriesUntilMaxAttempts()
+{
+    auto url = QString("https://api.retry.test/x/web-interface/view");
+    QNetworkRequest request((QUrl(url)));
+    FakeTransport fake(request, { httpResponse(503) });
+
+    QElapsedTimer timer;
+    timer.start();
+    auto reply = send(url, false, fake);
+    QVERIFY(reply->isFinished());
+    QCOMPARE(fake.attemptCnt, RetryPolicy::inst()->ruleOf(QUrl(url)).maxAttempts);
+    QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 503);
+    // backoff of 500 and 1000 ms, half of which may be cut by jitter
+    QVERIFY(timer.elapsed() >= 250 + 500);
+}
+
+void RetryPolicyTest::stopsRetryingOnSuccess()
+{
+    auto url = QString("https://api.success.test/x/web-interface/view");
+    QNetworkRequest request((QUrl(url)));
+    FakeTransport fake(request, { httpResponse(502), httpResponse(200, R"({"code":0,"data":{}})") });
+
+    auto reply = send(url, false, fake);
+    QVERIFY(reply->isFinished());
+    QCOMPARE(fake.attemptCnt, 2);
+    QCOMPARE(reply->error(), QNetworkReply::NoError);
+    QCOMPARE(reply->readAll(), QByteArray(R"({"code":0,"data":{}})"));
+}
+
+void RetryPolicyTest::doesNotRetryClientError()
+{
+    auto url = QString("https://api.notfound.test/x/web-interface/view");
+    QNetworkRequest request((QUrl(url)));
+    FakeTransport fake(request, { httpResponse(404) });
+
+    auto reply = send(url, false, fake);
+    QVERIFY(reply->isFinished());
+    QCOMPARE(fake.attemptCnt, 1);
+}
+
+void RetryPolicyTest::opensCircuitOnRateLimitCode()
+{
+    auto host = QString("api.throttled.test");
+    auto url = "https://" + host + "/x/web-interface/view";
+    QNetworkRequest request((QUrl(url)));
+    FakeTransport fake(request, { httpResponse(200, R"({"code":-412,"message":"请求被拦截"})") });
+
+    auto policy = RetryPolicy::inst();
+    QCOMPARE(policy->circuitRemainingTime(host), qint64(0));
+    // the throttled request is held back until the circuit closes
+    auto reply = send(url, false, fake, 1000);
+    QVERIFY(!reply->isFinished());
+    QCOMPARE(fake.attemptCnt, 1);
+    QVERIFY(policy->circuitRemainingTime(host) > 0);
+
+    reply->abort();
+    QCOMPARE(reply->error(), QNetworkReply::OperationCanceledError);
+    policy->onSucceeded(host);
+    QCOMPARE(policy->circuitRemainingTime(host), qint64(0));
+}
+
+void RetryPolicyTest::doesNotRetrySentPost()
+{
+    auto url = QString("https://api.post.test/x/v2/reply/add");
+    QNetworkRequest request((QUrl(url)));
+    FakeTransport fake(request, { errorResponse(QNetworkReply::RemoteHostClosedError) });
+
+    auto reply = send(url, true, fake);
+    QVERIFY(reply->isFinished());
+    QCOMPARE(fake.attemptCnt, 1);
+    QCOMPARE(reply->error(), QNetworkReply::RemoteHostClosedError);
+}
+
+void RetryPolicyTest::retriesUnsentPost()
+{
+    auto url = QString("https://api.unsent.test/x/v2/reply/add");
+    QNetworkRequest request((QUrl(url)));
+    FakeTransport fake(request, { errorResponse(QNetworkReply::ConnectionRefusedError), httpResponse(200, R"({"code":0})") });
+
+    auto reply = send(url, true, fake);
+    QVERIFY(reply->isFinished());
+    QCOMPARE(fake.attemptCnt, 2);
+    QCOMPARE(reply->error(), QNetworkReply::NoError);
+}
+
+void RetryPolicyTest::retriesIdempotentPost()
+{
+    auto url = QString("https://manga.idempotent.test/twirp/comic.v1.Comic/ComicDetail");
+    QNetworkRequest request((QUrl(url)));
+    FakeTransport fake(request, { errorResponse(QNetworkReply::RemoteHostClosedError), httpResponse(200, R"({"code":0})") });
+
+    QVERIFY(RetryPolicy::inst()->ruleOf(QUrl(url)).isIdempotentPost);
+    auto reply = send(url, true, fake);
+    QVERIFY(reply->isFinished());
+    QCOMPARE(fake.attemptCnt, 2);
+    QCOMPARE(reply->error(), QNetworkReply::NoError);
+}
+
+QTEST_GUILESS_MAIN(RetryPolicyTest)
+
+#include "tst_RetryPolicy.moc"